@@ -0,0 +1,274 @@
+/* bench.c - Microbenchmarks of the pattern matcher and the log scanner
+ *   (for bench.sh).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "plat.h"
+#include "re.h"
+#include "mpat.h"
+#include "mon.h"
+#include "corpus.h"
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC 1
+#endif
+
+/* One of each kind of pattern; the lines log_gen makes hits match all
+ * but "anchored" (which only matches plain text). */
+typedef struct bench_pat_s {
+  const char *cls;
+  const char *pattern;
+} bench_pat_t;
+
+bench_pat_t bench_pats[] = {
+  {"literal", "status=503"},                 /* Literal check only. */
+  {"anchored", "^\\S+ ERROR "},
+  {"class", "took [5-9]\\d\\d ms"},
+  {"dotstar", "ERROR.*status=503"},
+  {"multistar", "\\d+.*ERROR.*\\d+ ms"},     /* Backtracks heavily. */
+  {"noliteral", "\\s[5-9]\\d\\d\\s"},        /* No literal to check first. */
+  {NULL, NULL}
+};
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+corpus_t *corpus;
+int reps;
+char *mon_buf;
+volatile int scan_stop = 0;
+
+
+static uint64_t cycles(void) {
+#ifdef BENCH_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}  /* cycles */
+
+
+/* Best of reps runs of a benchmark. */
+typedef struct bench_time_s {
+  uint64_t ns;
+  uint64_t cycles;
+} bench_time_t;
+
+static void time_start(uint64_t *ns0, uint64_t *c0) {
+  *ns0 = plat_monotonic_ns();
+  *c0 = cycles();
+}  /* time_start */
+
+static void time_stop(bench_time_t *t, uint64_t ns0, uint64_t c0) {
+  uint64_t c = cycles() - c0;
+  uint64_t ns = plat_monotonic_ns() - ns0;
+
+  if (t->ns == 0 || ns < t->ns) {
+    t->ns = ns;
+    t->cycles = c;
+  }
+}  /* time_stop */
+
+
+/* One machine-readable record: "bench=<name> key=value ...". */
+static void report(const char *name, const char *cls, const char *engine,
+    uint64_t matches, const bench_time_t *t) {
+  printf("bench=%s class=%s engine=%s lines=%d bytes=%lu matches=%lu ns_per_line=%.1f gb_per_s=%.3f",
+      name, cls, engine, corpus->num_lines, (unsigned long)corpus->size, (unsigned long)matches,
+      (double)t->ns / corpus->num_lines, (double)corpus->size / (double)t->ns);
+#ifdef BENCH_TSC
+  printf(" cycles_per_byte=%.2f\n", (double)t->cycles / (double)corpus->size);
+#else
+  printf(" cycles_per_byte=nan\n");
+#endif
+}  /* report */
+
+
+/* Compile (and free) each pattern many times. */
+static void bench_compile(void) {
+  int k, i, n = 10000;
+  bench_time_t t;
+  uint64_t ns0, c0;
+  re_t *re;
+
+  for (k = 0; bench_pats[k].cls != NULL; k++) {
+    memset(&t, 0, sizeof(t));
+    for (i = 0; i < reps; i++) {
+      int j;
+      time_start(&ns0, &c0);
+      for (j = 0; j < n; j++) {
+        re = re_compile(bench_pats[k].pattern);  E(re == NULL);
+        re_free(re);
+      }
+      time_stop(&t, ns0, c0);
+    }
+    printf("bench=re_compile class=%s compiles=%d ns_per_compile=%.1f\n",
+        bench_pats[k].cls, n, (double)t.ns / n);
+  }
+}  /* bench_compile */
+
+
+/* Match every line with each pattern and engine.  Returns 1 if the
+ * engines disagree. */
+static int bench_match(void) {
+  static const int engines[] = { RE_ENGINE_BACKTRACK, RE_ENGINE_PIKEVM };
+  static const char *engine_names[] = { "backtrack", "pikevm" };
+  int k, e, r, i, rc = 0;
+  uint64_t m, first_m = 0, ns0, c0;
+  bench_time_t t;
+  re_t *re;
+
+  for (k = 0; bench_pats[k].cls != NULL; k++) {
+    printf("# class=%s pattern: %s\n", bench_pats[k].cls, bench_pats[k].pattern);
+    for (e = 0; e < 2; e++) {
+      re = re_compile(bench_pats[k].pattern);  E(re == NULL);
+      re_set_engine(re, engines[e]);
+      memset(&t, 0, sizeof(t));
+      m = 0;
+      for (r = 0; r < reps; r++) {
+        m = 0;
+        time_start(&ns0, &c0);
+        for (i = 0; i < corpus->num_lines; i++) {
+          m += re_matchn(re, corpus->text + corpus->line_off[i], corpus->line_len[i], NULL, NULL);
+        }
+        time_stop(&t, ns0, c0);
+      }
+      report("re_match", bench_pats[k].cls, engine_names[e], m, &t);
+      if (e == 0) {
+        first_m = m;
+      } else if (m != first_m) {
+        printf("MISMATCH: class=%s backtrack=%lu %s=%lu\n", bench_pats[k].cls,
+            (unsigned long)first_m, engine_names[e], (unsigned long)m);
+        rc = 1;
+      }
+      re_free(re);
+    }
+  }
+  return rc;
+}  /* bench_match */
+
+
+/* Nothing in the corpus triggers (see bench_scan). */
+static void scan_trigger(mon_file_t *mf, int pat_idx) {
+  (void)mf; (void)pat_idx;
+  scan_stop = 1;
+}  /* scan_trigger */
+
+
+/* Feed the corpus through mon_scan a read buffer at a time, as dual_cap's
+ * mon_read does with a file (without the reads).  Returns the lines
+ * scanned (an unterminated last line is not). */
+static uint64_t scan_corpus(mon_scanner_t *ms, mon_file_t *mf) {
+  size_t off = 0, buf_len = 0, n, used;
+
+  mf->lines = 0;
+  mf->long_lines = 0;
+  mf->in_long_line = 0;
+  while (off < corpus->size || buf_len > 0) {
+    n = corpus->size - off;
+    if (n > MON_BUF_SIZE - buf_len) { n = MON_BUF_SIZE - buf_len; }
+    memcpy(mon_buf + buf_len, corpus->text + off, n);
+    off += n;
+    buf_len += n;
+    ms->observed_ns = plat_monotonic_ns();
+    used = mon_scan(ms, mf, mon_buf, buf_len);
+    buf_len -= used;
+    if (buf_len > 0 && used > 0) {
+      memmove(mon_buf, mon_buf + used, buf_len);
+    }
+    if (n == 0 && used == 0) { break; }  /* Unterminated last line. */
+  }
+  return mf->lines;
+}  /* scan_corpus */
+
+
+/* The log scanner: line splitting, then either a pattern that is never
+ * found (the common case: every line rejected by the literal check) or
+ * all of the patterns, each counted by a mon_rate that never fires (its
+ * window is too long for anything to leave it).  matches: lines matched,
+ * summed over the patterns. */
+static void bench_scan(void) {
+  mon_scanner_t ms;
+  mon_file_t mf;
+  mpat_t *pats;
+  mon_rate_t *rate;
+  bench_time_t t;
+  uint64_t lines = 0, matches = 0, ns0, c0;
+  int k, r, all;
+
+  memset(&ms, 0, sizeof(ms));
+  ms.stop = &scan_stop;
+  ms.trigger = scan_trigger;
+  mon_buf = (char *)malloc(MON_BUF_SIZE);  E(mon_buf == NULL);
+  for (all = 0; all < 2; all++) {
+    pats = mpat_create();
+    if (!all) {
+      mpat_add(pats, "NO_SUCH_TEXT");
+    } else {
+      for (k = 0; bench_pats[k].cls != NULL; k++) {
+        mpat_add(pats, bench_pats[k].pattern);
+        mon_rate_set(pats, k, INT_MAX, INT_MAX);
+      }
+    }
+    mpat_set_engine(pats, RE_ENGINE_AUTO);
+    mpat_build(pats);
+
+    memset(&mf, 0, sizeof(mf));
+    mf.path = "bench";
+    mf.patterns = pats;
+    memset(&t, 0, sizeof(t));
+    for (r = 0; r < reps; r++) {
+      time_start(&ns0, &c0);
+      lines = scan_corpus(&ms, &mf);
+      time_stop(&t, ns0, c0);
+      matches = 0;
+      for (k = 0; all && k < pats->num_pats; k++) {
+        rate = (mon_rate_t *)pats->pat_data[k];
+        matches += rate->total;
+        memset(rate->buckets, 0, sizeof(rate->buckets));
+        rate->total = 0;
+      }
+    }
+    E(lines != (uint64_t)corpus->num_lines - (corpus->text[corpus->size - 1] != '\n') || scan_stop);
+    report("mon_scan", all ? "all" : "split", "auto", matches, &t);
+
+    if (mf.stream != NULL) { mpat_stream_free(mf.stream); }
+    mon_pats_free(pats);
+  }
+  free(mon_buf);
+}  /* bench_scan */
+
+
+int main(int argc, char **argv) {
+  int rc;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: bench <corpus_file> [repetitions]\n");
+    exit(1);
+  }
+  E(plat_init());
+  corpus = corpus_load(argv[1]);
+  reps = (argc == 3) ? atoi(argv[2]) : 3;
+  E(reps < 1 || corpus->num_lines == 0);
+
+  bench_compile();
+  rc = bench_match();
+  bench_scan();
+
+  corpus_free(corpus);
+  return rc;
+}  /* main */
@@ -0,0 +1,39 @@
+#!/bin/bash
+# bench.sh - Microbenchmarks of re_compile, re_match (per kind of
+#   pattern and engine) and the log scanner (mon_scan), on a synthetic
+#   log corpus from log_gen or on a given one.  Prints one record per
+#   benchmark, "bench=<name> key=value ...", for comparing commits; lines
+#   starting with '#' are comments.  Exits non-zero if the two engines
+#   disagree.
+# Usage: ./bench.sh [-r repetitions] [-f corpus_file] [log_gen options]
+#   E.g. ./bench.sh -n 500000 -l 60-300 -t 1:20000 -d 0.05 -j
+#   Each benchmark is run repetitions times (default 3); the best is
+#   reported.
+
+REPS=3
+CORPUS=""
+while [ $# -gt 0 ]; do :
+  case "$1" in
+    -r) REPS=$2; shift 2 ;;
+    -f) CORPUS=$2; shift 2 ;;
+    *) break ;;
+  esac
+done
+
+gcc -Wall -O2 -o log_gen log_gen.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+# Optimized, unlike bld.sh's debug build.  (Not bld.sh itself: that would
+# rebuild dual_cap, e.g. under tst.sh.)
+gcc -Wall -O2 -o bench -pthread bench.c corpus.c mon.c re.c mpat.c mwork.c field.c plat_unix.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+
+GEN_ARGS="$*"
+if [ -z "$CORPUS" ]; then :
+  CORPUS=bench_corpus.log
+  ./log_gen -o $CORPUS "$@";  if [ "$?" -ne 0 ]; then rm -f log_gen bench; exit 1; fi
+fi
+
+echo "# commit=`git rev-parse --short HEAD 2>/dev/null || echo unknown` corpus=$CORPUS log_gen_args='$GEN_ARGS' reps=$REPS"
+./bench $CORPUS $REPS
+RC=$?
+
+rm -f log_gen bench bench_corpus.log
+exit $RC
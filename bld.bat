@@ -1,5 +1,16 @@
 @echo off
 rem bld.bat
 
-cl /std:c11 /W4 /O2 /MT /nologo /D_CRT_SECURE_NO_WARNINGS /D_CRT_NONSTDC_NO_DEPRECATE dual_cap.c re.c plat_win.c ws2_32.lib /Fe:dual_cap.exe
+cl /std:c11 /W4 /O2 /MT /nologo /D_CRT_SECURE_NO_WARNINGS re_gen.c re.c /Fe:re_gen.exe
+if %ERRORLEVEL% neq 0 exit /b %ERRORLEVEL%
+
+rem RE_GEN_PATS=<pattern_file>: link re_gen matchers for those patterns.
+set GEN=
+if defined RE_GEN_PATS (
+  re_gen.exe -o re_gen_pats.c %RE_GEN_PATS%
+  if errorlevel 1 exit /b 1
+  set GEN=/DRE_GEN_PATTERNS re_gen_pats.c
+)
+
+cl /std:c11 /W4 /O2 /MT /nologo /D_CRT_SECURE_NO_WARNINGS /D_CRT_NONSTDC_NO_DEPRECATE dual_cap.c mon.c re.c mpat.c mwork.c field.c bpf.c cap.c capwr.c plat_win.c %GEN% ws2_32.lib /Fe:dual_cap.exe
 exit /b %ERRORLEVEL%
@@ -13,4 +13,18 @@ done
 
 rm -f dual_cap
 
-gcc -Wall -g -o dual_cap -pthread dual_cap.c re.c plat_unix.c;  if [ $? -ne 0 ]; then exit 1; fi
+# cap_compress needs zlib.
+ZLIB=""
+if echo "#include <zlib.h>" | gcc -E - >/dev/null 2>&1; then ZLIB="-DCAPWR_ZLIB -lz"; fi
+
+rm -f re_gen
+gcc -Wall -g -o re_gen re_gen.c re.c;  if [ $? -ne 0 ]; then exit 1; fi
+
+# RE_GEN_PATS=<pattern_file>: link re_gen matchers for those patterns.
+GEN=""
+if [ -n "$RE_GEN_PATS" ]; then :
+  ./re_gen -o re_gen_pats.c "$RE_GEN_PATS";  if [ $? -ne 0 ]; then exit 1; fi
+  GEN="-DRE_GEN_PATTERNS re_gen_pats.c"
+fi
+
+gcc -Wall -g -o dual_cap -pthread dual_cap.c mon.c re.c mpat.c mwork.c field.c bpf.c cap.c capwr.c plat_unix.c $GEN $ZLIB;  if [ $? -ne 0 ]; then exit 1; fi
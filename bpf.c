@@ -0,0 +1,593 @@
+/* bpf.c - Capture filter compiler for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "bpf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+/* Classic BPF opcodes (as in linux/filter.h). */
+#define OP_LD_W_ABS   0x20
+#define OP_LD_H_ABS   0x28
+#define OP_LD_B_ABS   0x30
+#define OP_LD_W_LEN   0x80
+#define OP_LD_H_IND   0x48
+#define OP_LDX_B_MSH  0xb1  /* X = 4 * (pkt[k] & 0xf) */
+#define OP_ALU_AND_K  0x54
+#define OP_JEQ_K      0x15
+#define OP_JGT_K      0x25
+#define OP_JGE_K      0x35
+#define OP_JSET_K     0x45
+#define OP_RET_K      0x06
+
+#define BPF_MAX_INSNS 4096  /* Kernel limit. */
+#define BPF_MAX_NODES 256
+#define BPF_MAX_LABELS (BPF_MAX_INSNS * 2)
+#define LBL_NEXT (-1)  /* Jump target: the next instruction. */
+
+/* Offsets in an untagged Ethernet frame carrying IPv4. */
+#define ETH_TYPE   12
+#define IP_FRAG    20
+#define IP_PROTO   23
+#define IP_SRC     26
+#define IP_DST     30
+#define IP_HDR     14
+
+#define ETHERTYPE_IP   0x0800
+#define ETHERTYPE_ARP  0x0806
+#define ETHERTYPE_IP6  0x86dd
+
+/* Node and primitive kinds. */
+#define N_AND  1
+#define N_OR   2
+#define N_NOT  3
+#define N_PRIM 4
+
+#define P_PROTO     1
+#define P_HOST      2
+#define P_NET       3
+#define P_PORT      4
+#define P_PORTRANGE 5
+#define P_LESS      6
+#define P_GREATER   7
+
+/* Protocol qualifiers: ethertypes are > 255, IP protocols are not. */
+#define PR_NONE 0
+#define PR_ICMP 1
+#define PR_TCP  6
+#define PR_UDP  17
+#define PR_SCTP 132
+#define PR_IP   ETHERTYPE_IP
+#define PR_ARP  ETHERTYPE_ARP
+#define PR_IP6  ETHERTYPE_IP6
+
+#define D_ANY 0
+#define D_SRC 1
+#define D_DST 2
+
+typedef struct bpf_node_s {
+  int type;
+  struct bpf_node_s *a;
+  struct bpf_node_s *b;
+  int prim;
+  int proto;
+  int dir;
+  uint32_t v1;  /* Address, low port or length. */
+  uint32_t v2;  /* Mask or high port. */
+} bpf_node_t;
+
+/* Compiler state.  Instructions are emitted with jump targets as label
+ * numbers (or LBL_NEXT), resolved to offsets at the end; every jump is
+ * forward, as classic BPF requires. */
+typedef struct bpfc_s {
+  const char *expr;
+  const char *p;        /* Parse position. */
+  char tok[64];         /* Current token ("" at end). */
+  const char *tok_pos;
+
+  bpf_node_t nodes[BPF_MAX_NODES];
+  int num_nodes;
+
+  bpf_insn_t insns[BPF_MAX_INSNS];
+  int jt_lbl[BPF_MAX_INSNS];
+  int jf_lbl[BPF_MAX_INSNS];
+  int num_insns;
+  int lbl_pos[BPF_MAX_LABELS];
+  int num_lbls;
+
+  char *err;
+  size_t err_size;
+  int failed;
+} bpfc_t;
+
+
+static void fail(bpfc_t *c, const char *fmt, ...) {
+  va_list ap;
+
+  if (c->failed) { return; }
+  c->failed = 1;
+  va_start(ap, fmt);
+  vsnprintf(c->err, c->err_size, fmt, ap);
+  va_end(ap);
+}  /* fail */
+
+
+/* Tokens: words (which include addresses, a/len and lo-hi), "(", ")",
+ * "!", "&&" and "||". */
+static void next_tok(bpfc_t *c) {
+  size_t n = 0;
+
+  while (isspace((unsigned char)*c->p)) { c->p++; }
+  c->tok_pos = c->p;
+  if (*c->p == '\0') {
+    c->tok[0] = '\0';
+  } else if (strncmp(c->p, "&&", 2) == 0 || strncmp(c->p, "||", 2) == 0) {
+    memcpy(c->tok, c->p, 2);  c->tok[2] = '\0';
+    c->p += 2;
+  } else if (*c->p == '(' || *c->p == ')' || *c->p == '!') {
+    c->tok[0] = *c->p++;  c->tok[1] = '\0';
+  } else {
+    while (isalnum((unsigned char)*c->p) || *c->p == '.' || *c->p == '/' || *c->p == '-') {
+      if (n < sizeof(c->tok) - 1) { c->tok[n++] = *c->p; }
+      c->p++;
+    }
+    c->tok[n] = '\0';
+    if (n == 0) {
+      fail(c, "unexpected '%c' at offset %d", *c->p, (int)(c->p - c->expr));
+    }
+  }
+}  /* next_tok */
+
+
+static int tok_is(bpfc_t *c, const char *s) {
+  return strcmp(c->tok, s) == 0;
+}  /* tok_is */
+
+
+static bpf_node_t *new_node(bpfc_t *c, int type, bpf_node_t *a, bpf_node_t *b) {
+  bpf_node_t *n;
+
+  if (c->num_nodes == BPF_MAX_NODES) {
+    fail(c, "filter too long");
+    return NULL;
+  }
+  n = &c->nodes[c->num_nodes++];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return n;
+}  /* new_node */
+
+
+static int parse_uint(const char *s, uint32_t max, uint32_t *val) {
+  char *end;
+  unsigned long v;
+
+  if (!isdigit((unsigned char)*s)) { return 0; }
+  v = strtoul(s, &end, 10);
+  if (*end != '\0' || v > max) { return 0; }
+  *val = (uint32_t)v;
+  return 1;
+}  /* parse_uint */
+
+
+/* "a.b.c.d", or for a net also "a[.b[.c]]" (the octets given are the
+ * network part), optionally followed by "/len". */
+static int parse_addr(const char *s, int is_net, uint32_t *addr, uint32_t *mask) {
+  uint32_t len;
+  int num_octets = 0;
+  unsigned long octet;
+  char *end;
+
+  *addr = 0;
+  while (1) {
+    if (num_octets == 4 || !isdigit((unsigned char)*s)) { return 0; }
+    octet = strtoul(s, &end, 10);
+    if (octet > 255) { return 0; }
+    *addr = (*addr << 8) | (uint32_t)octet;
+    num_octets++;
+    if (*end != '.') { break; }
+    s = end + 1;
+  }
+  if (!is_net && (num_octets != 4 || *end != '\0')) { return 0; }
+
+  len = 8 * num_octets;
+  *addr <<= 8 * (4 - num_octets);
+  if (*end == '/') {
+    if (!parse_uint(end + 1, 32, &len)) { return 0; }
+  } else if (*end != '\0') {
+    return 0;
+  }
+
+  *mask = (len == 0) ? 0 : (0xffffffffU << (32 - len));
+  if (*addr & ~*mask) { return 0; }  /* Host bits set. */
+  return 1;
+}  /* parse_addr */
+
+
+/* [proto] [src|dst] host|net|port|portrange <value> (net also takes
+ * "mask <a.b.c.d>"), a bare proto, or
+ * less|greater <length>. */
+static bpf_node_t *parse_prim(bpfc_t *c) {
+  bpf_node_t *n = new_node(c, N_PRIM, NULL, NULL);
+  char *dash;
+  char buf[64];
+  uint32_t mask;
+
+  if (n == NULL) { return NULL; }
+
+  if (tok_is(c, "less") || tok_is(c, "greater")) {
+    n->prim = tok_is(c, "less") ? P_LESS : P_GREATER;
+    next_tok(c);
+    if (!parse_uint(c->tok, 0xffffffffU, &n->v1)) {
+      fail(c, "expected a length at offset %d", (int)(c->tok_pos - c->expr));
+      return NULL;
+    }
+    next_tok(c);
+    return n;
+  }
+
+  if (tok_is(c, "ip")) { n->proto = PR_IP; }
+  else if (tok_is(c, "ip6")) { n->proto = PR_IP6; }
+  else if (tok_is(c, "arp")) { n->proto = PR_ARP; }
+  else if (tok_is(c, "tcp")) { n->proto = PR_TCP; }
+  else if (tok_is(c, "udp")) { n->proto = PR_UDP; }
+  else if (tok_is(c, "sctp")) { n->proto = PR_SCTP; }
+  else if (tok_is(c, "icmp")) { n->proto = PR_ICMP; }
+  if (n->proto != PR_NONE) { next_tok(c); }
+
+  if (tok_is(c, "src")) { n->dir = D_SRC;  next_tok(c); }
+  else if (tok_is(c, "dst")) { n->dir = D_DST;  next_tok(c); }
+
+  if (tok_is(c, "host")) { n->prim = P_HOST; }
+  else if (tok_is(c, "net")) { n->prim = P_NET; }
+  else if (tok_is(c, "port")) { n->prim = P_PORT; }
+  else if (tok_is(c, "portrange")) { n->prim = P_PORTRANGE; }
+  else if (n->proto != PR_NONE && n->dir == D_ANY) {
+    n->prim = P_PROTO;
+    return n;
+  } else {
+    fail(c, "expected host, net, port or portrange at offset %d", (int)(c->tok_pos - c->expr));
+    return NULL;
+  }
+  next_tok(c);
+
+  if (n->prim == P_HOST || n->prim == P_NET) {
+    if (n->proto == PR_IP6 || n->proto == PR_ARP) {
+      fail(c, "only IPv4 addresses are supported");
+      return NULL;
+    }
+    if (!parse_addr(c->tok, n->prim == P_NET, &n->v1, &n->v2)) {
+      fail(c, "bad IPv4 %s at offset %d", (n->prim == P_NET) ? "network" : "address",
+          (int)(c->tok_pos - c->expr));
+      return NULL;
+    }
+    if (n->prim == P_NET && strchr(c->tok, '/') == NULL) {
+      next_tok(c);
+      if (!tok_is(c, "mask")) { return n; }
+      next_tok(c);
+      if (!parse_addr(c->tok, 0, &n->v2, &mask) || (n->v1 & ~n->v2)) {
+        fail(c, "bad IPv4 mask at offset %d", (int)(c->tok_pos - c->expr));
+        return NULL;
+      }
+    }
+  } else {
+    if (n->proto != PR_NONE && n->proto != PR_TCP && n->proto != PR_UDP && n->proto != PR_SCTP) {
+      fail(c, "ports need tcp, udp or sctp");
+      return NULL;
+    }
+    strcpy(buf, c->tok);
+    dash = strchr(buf, '-');
+    if (n->prim == P_PORTRANGE && dash != NULL) { *dash = '\0'; }
+    if (!parse_uint(buf, 65535, &n->v1) ||
+        (n->prim == P_PORTRANGE && (dash == NULL || !parse_uint(dash + 1, 65535, &n->v2)))) {
+      fail(c, "bad port at offset %d", (int)(c->tok_pos - c->expr));
+      return NULL;
+    }
+    if (n->prim == P_PORT) { n->v2 = n->v1; }
+    if (n->v1 > n->v2) {
+      uint32_t t = n->v1;  n->v1 = n->v2;  n->v2 = t;
+    }
+  }
+  next_tok(c);
+  return n;
+}  /* parse_prim */
+
+
+static bpf_node_t *parse_expr(bpfc_t *c);
+
+static bpf_node_t *parse_factor(bpfc_t *c) {
+  bpf_node_t *n;
+
+  if (c->failed) { return NULL; }
+  if (tok_is(c, "not") || tok_is(c, "!")) {
+    next_tok(c);
+    n = parse_factor(c);
+    return (n == NULL) ? NULL : new_node(c, N_NOT, n, NULL);
+  }
+  if (tok_is(c, "(")) {
+    next_tok(c);
+    n = parse_expr(c);
+    if (n != NULL && !tok_is(c, ")")) {
+      fail(c, "expected ')' at offset %d", (int)(c->tok_pos - c->expr));
+      return NULL;
+    }
+    next_tok(c);
+    return n;
+  }
+  if (c->tok[0] == '\0') {
+    fail(c, "unexpected end of filter");
+    return NULL;
+  }
+  return parse_prim(c);
+}  /* parse_factor */
+
+
+static bpf_node_t *parse_term(bpfc_t *c) {
+  bpf_node_t *n = parse_factor(c);
+
+  while (n != NULL && (tok_is(c, "and") || tok_is(c, "&&"))) {
+    bpf_node_t *b;
+    next_tok(c);
+    b = parse_factor(c);
+    n = (b == NULL) ? NULL : new_node(c, N_AND, n, b);
+  }
+  return n;
+}  /* parse_term */
+
+
+static bpf_node_t *parse_expr(bpfc_t *c) {
+  bpf_node_t *n = parse_term(c);
+
+  while (n != NULL && (tok_is(c, "or") || tok_is(c, "||"))) {
+    bpf_node_t *b;
+    next_tok(c);
+    b = parse_term(c);
+    n = (b == NULL) ? NULL : new_node(c, N_OR, n, b);
+  }
+  return n;
+}  /* parse_expr */
+
+
+static int new_label(bpfc_t *c) {
+  if (c->num_lbls == BPF_MAX_LABELS) {
+    fail(c, "filter too long");
+    return LBL_NEXT;
+  }
+  c->lbl_pos[c->num_lbls] = -1;
+  return c->num_lbls++;
+}  /* new_label */
+
+
+static void bind_label(bpfc_t *c, int lbl) {
+  if (lbl != LBL_NEXT) { c->lbl_pos[lbl] = c->num_insns; }
+}  /* bind_label */
+
+
+static void emit(bpfc_t *c, uint16_t code, uint32_t k, int jt, int jf) {
+  if (c->num_insns == BPF_MAX_INSNS) {
+    fail(c, "filter too long");
+    return;
+  }
+  c->insns[c->num_insns].code = code;
+  c->insns[c->num_insns].k = k;
+  c->jt_lbl[c->num_insns] = jt;
+  c->jf_lbl[c->num_insns] = jf;
+  c->num_insns++;
+}  /* emit */
+
+
+/* Jump to t if it's IPv4, else to f. */
+static void gen_is_ip(bpfc_t *c, int t, int f) {
+  emit(c, OP_LD_H_ABS, ETH_TYPE, LBL_NEXT, LBL_NEXT);
+  emit(c, OP_JEQ_K, ETHERTYPE_IP, t, f);
+}  /* gen_is_ip */
+
+
+/* Jump to t if it's IPv4 with the given protocol, else to f. */
+static void gen_ip_proto(bpfc_t *c, int proto, int t, int f) {
+  gen_is_ip(c, LBL_NEXT, f);
+  emit(c, OP_LD_B_ABS, IP_PROTO, LBL_NEXT, LBL_NEXT);
+  emit(c, OP_JEQ_K, proto, t, f);
+}  /* gen_ip_proto */
+
+
+/* Source and/or destination IPv4 address under mask equals addr. */
+static void gen_addr(bpfc_t *c, bpf_node_t *n, int t, int f) {
+  int other = LBL_NEXT;
+
+  if (n->dir == D_ANY) { other = new_label(c); }
+  if (n->dir != D_DST) {
+    emit(c, OP_LD_W_ABS, IP_SRC, LBL_NEXT, LBL_NEXT);
+    if (n->v2 != 0xffffffffU) { emit(c, OP_ALU_AND_K, n->v2, LBL_NEXT, LBL_NEXT); }
+    emit(c, OP_JEQ_K, n->v1, t, (n->dir == D_ANY) ? other : f);
+  }
+  bind_label(c, other);
+  if (n->dir != D_SRC) {
+    emit(c, OP_LD_W_ABS, IP_DST, LBL_NEXT, LBL_NEXT);
+    if (n->v2 != 0xffffffffU) { emit(c, OP_ALU_AND_K, n->v2, LBL_NEXT, LBL_NEXT); }
+    emit(c, OP_JEQ_K, n->v1, t, f);
+  }
+}  /* gen_addr */
+
+
+/* The port at offset (from the IP header, X = its length) in [lo, hi]. */
+static void gen_port_at(bpfc_t *c, uint32_t off, uint32_t lo, uint32_t hi, int t, int f) {
+  emit(c, OP_LD_H_IND, IP_HDR + off, LBL_NEXT, LBL_NEXT);
+  if (lo == hi) {
+    emit(c, OP_JEQ_K, lo, t, f);
+  } else {
+    emit(c, OP_JGE_K, lo, LBL_NEXT, f);
+    emit(c, OP_JGT_K, hi, f, t);
+  }
+}  /* gen_port_at */
+
+
+static void gen_port(bpfc_t *c, bpf_node_t *n, int t, int f) {
+  int ok, other;
+
+  if (n->proto != PR_NONE) {
+    gen_ip_proto(c, n->proto, LBL_NEXT, f);
+  } else {
+    ok = new_label(c);
+    gen_is_ip(c, LBL_NEXT, f);
+    emit(c, OP_LD_B_ABS, IP_PROTO, LBL_NEXT, LBL_NEXT);
+    emit(c, OP_JEQ_K, PR_TCP, ok, LBL_NEXT);
+    emit(c, OP_JEQ_K, PR_UDP, ok, LBL_NEXT);
+    emit(c, OP_JEQ_K, PR_SCTP, ok, f);
+    bind_label(c, ok);
+  }
+  /* Only the first fragment has the ports. */
+  emit(c, OP_LD_H_ABS, IP_FRAG, LBL_NEXT, LBL_NEXT);
+  emit(c, OP_JSET_K, 0x1fff, f, LBL_NEXT);
+  emit(c, OP_LDX_B_MSH, IP_HDR, LBL_NEXT, LBL_NEXT);
+
+  if (n->dir == D_SRC) {
+    gen_port_at(c, 0, n->v1, n->v2, t, f);
+  } else if (n->dir == D_DST) {
+    gen_port_at(c, 2, n->v1, n->v2, t, f);
+  } else {
+    other = new_label(c);
+    gen_port_at(c, 0, n->v1, n->v2, t, other);
+    bind_label(c, other);
+    gen_port_at(c, 2, n->v1, n->v2, t, f);
+  }
+}  /* gen_port */
+
+
+/* Generate code for n that jumps to label t if it matches, else f. */
+static void gen(bpfc_t *c, bpf_node_t *n, int t, int f) {
+  int mid;
+
+  switch (n->type) {
+  case N_AND:
+    mid = new_label(c);
+    gen(c, n->a, mid, f);
+    bind_label(c, mid);
+    gen(c, n->b, t, f);
+    break;
+  case N_OR:
+    mid = new_label(c);
+    gen(c, n->a, t, mid);
+    bind_label(c, mid);
+    gen(c, n->b, t, f);
+    break;
+  case N_NOT:
+    gen(c, n->a, f, t);
+    break;
+  default:
+    switch (n->prim) {
+    case P_PROTO:
+      if (n->proto > 255) {
+        emit(c, OP_LD_H_ABS, ETH_TYPE, LBL_NEXT, LBL_NEXT);
+        emit(c, OP_JEQ_K, n->proto, t, f);
+      } else {
+        gen_ip_proto(c, n->proto, t, f);
+      }
+      break;
+    case P_HOST:
+    case P_NET:
+      mid = new_label(c);
+      if (n->proto != PR_NONE && n->proto != PR_IP) {
+        gen_ip_proto(c, n->proto, mid, f);
+      } else {
+        gen_is_ip(c, mid, f);
+      }
+      bind_label(c, mid);
+      gen_addr(c, n, t, f);
+      break;
+    case P_PORT:
+    case P_PORTRANGE:
+      gen_port(c, n, t, f);
+      break;
+    case P_LESS:
+      emit(c, OP_LD_W_LEN, 0, LBL_NEXT, LBL_NEXT);
+      emit(c, OP_JGT_K, n->v1, f, t);
+      break;
+    case P_GREATER:
+      emit(c, OP_LD_W_LEN, 0, LBL_NEXT, LBL_NEXT);
+      emit(c, OP_JGE_K, n->v1, t, f);
+      break;
+    }
+  }
+}  /* gen */
+
+
+/* Turn jump labels into offsets. */
+static void resolve(bpfc_t *c) {
+  int i, off;
+
+  for (i = 0; i < c->num_insns && !c->failed; i++) {
+    off = (c->jt_lbl[i] == LBL_NEXT) ? 0 : c->lbl_pos[c->jt_lbl[i]] - (i + 1);
+    if (off < 0 || off > 255) { fail(c, "filter too long (jump out of range)"); }
+    c->insns[i].jt = (uint8_t)off;
+    off = (c->jf_lbl[i] == LBL_NEXT) ? 0 : c->lbl_pos[c->jf_lbl[i]] - (i + 1);
+    if (off < 0 || off > 255) { fail(c, "filter too long (jump out of range)"); }
+    c->insns[i].jf = (uint8_t)off;
+  }
+}  /* resolve */
+
+
+bpf_prog_t *bpf_compile(const char *expr, uint32_t snaplen, char *err, size_t err_size) {
+  bpfc_t *c = (bpfc_t *)calloc(1, sizeof(bpfc_t));
+  bpf_prog_t *prog = NULL;
+  bpf_node_t *root;
+  int t, f;
+
+  E(c == NULL);
+  c->expr = c->p = expr;
+  c->err = err;
+  c->err_size = err_size;
+
+  next_tok(c);
+  root = parse_expr(c);
+  if (root != NULL && c->tok[0] != '\0') {
+    fail(c, "unexpected '%s' at offset %d", c->tok, (int)(c->tok_pos - c->expr));
+  }
+
+  if (!c->failed) {
+    t = new_label(c);
+    f = new_label(c);
+    gen(c, root, t, f);
+    bind_label(c, t);
+    emit(c, OP_RET_K, snaplen, LBL_NEXT, LBL_NEXT);
+    bind_label(c, f);
+    emit(c, OP_RET_K, 0, LBL_NEXT, LBL_NEXT);
+    resolve(c);
+  }
+
+  if (!c->failed) {
+    prog = (bpf_prog_t *)malloc(sizeof(bpf_prog_t));  E(prog == NULL);
+    prog->len = c->num_insns;
+    prog->insns = (bpf_insn_t *)malloc(c->num_insns * sizeof(bpf_insn_t));  E(prog->insns == NULL);
+    memcpy(prog->insns, c->insns, c->num_insns * sizeof(bpf_insn_t));
+  }
+  free(c);
+  return prog;
+}  /* bpf_compile */
+
+
+void bpf_free(bpf_prog_t *prog) {
+  free(prog->insns);
+  free(prog);
+}  /* bpf_free */
@@ -0,0 +1,49 @@
+/* bpf.h - Capture filter compiler for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef BPF_H_INCLUDED
+#define BPF_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* One classic BPF instruction (same layout as Linux struct sock_filter). */
+typedef struct bpf_insn_s {
+  uint16_t code;
+  uint8_t jt;
+  uint8_t jf;
+  uint32_t k;
+} bpf_insn_t;
+
+typedef struct bpf_prog_s {
+  int len;
+  bpf_insn_t *insns;
+} bpf_prog_t;
+
+
+/* Compile a tcpdump-style filter expression (a subset; see README) for
+ * Ethernet frames into a program that accepts up to snaplen bytes of
+ * matching packets.  Returns NULL with a message in err on error. */
+bpf_prog_t *bpf_compile(const char *expr, uint32_t snaplen, char *err, size_t err_size);
+void bpf_free(bpf_prog_t *prog);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BPF_H_INCLUDED */
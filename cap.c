@@ -0,0 +1,744 @@
+/* cap.c - In-process packet capture for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* For sched_setaffinity. */
+#endif
+#include "plat.h"
+#include "cap.h"
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+
+/* Receive ring: CAP_NUM_BLOCKS blocks of CAP_BLOCK_SIZE.  The kernel
+ * hands a block to us when it is full or CAP_RETIRE_MS after its first
+ * packet, whichever comes first. */
+#define CAP_BLOCK_SIZE (1024 * 1024)
+#define CAP_NUM_BLOCKS 64
+#define CAP_FRAME_SIZE 2048  /* Required by the API; V3 packs packets tightly. */
+#define CAP_RETIRE_MS 10
+
+/* pcapng blocks (see the pcapng spec, draft-ietf-opsawg-pcapng). */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+typedef struct cap_epb_s {
+  uint32_t type;
+  uint32_t len;
+  uint32_t if_id;
+  uint32_t ts_high;
+  uint32_t ts_low;
+  uint32_t cap_len;
+  uint32_t orig_len;
+} cap_epb_t;
+
+/* One capture thread: its own socket (in the fanout group), ring and
+ * output file (a shard, if there are several threads), written by its
+ * own writer thread (see capwr.c) so that disk waits never hold up the
+ * ring.
+ * Rotation (cap_rotate_at): the main thread opens the next file's writer
+ * as next_wr; at the stop time the capture thread switches to it, leaves
+ * the old one in old_wr with its counters in gen_stats, and sets rotated
+ * for the main thread to finish the old file.
+ * Flight recorder: a byte ring of complete EPBs, oldest at pre_tail.
+ * Records never straddle the end of the buffer; when one doesn't fit,
+ * writing wraps to the start and pre_wrap marks where the data ends.
+ * Data is [pre_tail, pre_head) if pre_wrap is 0, otherwise
+ * [pre_tail, pre_wrap) followed by [0, pre_head). */
+typedef struct cap_wkr_s {
+  struct cap_s *cap;
+  int cpu;            /* Pin to this CPU (-1 = don't). */
+  int sock;
+  capwr_t *wr;
+  char *path;         /* Output file (owned). */
+  char *next_path;    /* After rotation (owned). */
+  capwr_t *volatile next_wr;
+  capwr_t *old_wr;
+  volatile int rotated;
+  int gen;            /* Rotations so far. */
+  cap_stats_t gen_stats;
+  uint64_t cpu_mark;  /* Thread CPU time at the last rotation. */
+  char *ring;
+  int cur_block;
+  char *pre_buf;      /* NULL: not a flight recorder. */
+  int recording;      /* Packets go to pre_buf (no stop time yet). */
+  size_t pre_size;
+  size_t pre_head;
+  size_t pre_tail;
+  size_t pre_wrap;
+  uint64_t pre_ns;
+  int skip_outgoing;  /* lo: each packet is seen leaving and arriving. */
+  plat_thread_t thr;
+  cap_stats_t stats;
+} cap_wkr_t;
+
+struct cap_s {
+  /* Stop time for the capture threads' generation gen (0 = not set). */
+  volatile uint64_t stop_wall_ns;
+  volatile int gen;
+  char *path;         /* Final output (owned). */
+  char *next_path;    /* After rotation (owned). */
+  char *iface;
+  int direct;
+  int compress;
+  int num_wkrs;
+  cap_wkr_t *wkrs;
+};
+
+
+/* Write one packet as an EPB (copied into the writer's batch, so the
+ * ring block can be handed back as soon as its packets are written). */
+static void cap_add_pkt(cap_wkr_t *w, uint64_t ts_ns, const char *data, uint32_t cap_len, uint32_t orig_len) {
+  uint32_t pad = (4 - (cap_len & 3)) & 3;
+  uint32_t len = (uint32_t)sizeof(cap_epb_t) + cap_len + pad + 4;
+  unsigned char tail[8];  /* Up to 3 pad bytes, then length. */
+  cap_epb_t epb;
+
+  epb.type = PCAPNG_EPB;
+  epb.len = len;
+  epb.if_id = 0;
+  epb.ts_high = (uint32_t)(ts_ns >> 32);
+  epb.ts_low = (uint32_t)ts_ns;
+  epb.cap_len = cap_len;
+  epb.orig_len = orig_len;
+  memset(tail, 0, 4);
+  memcpy(&tail[4], &len, 4);
+
+  capwr_write(w->wr, &epb, sizeof(epb));
+  capwr_write(w->wr, data, cap_len);
+  capwr_write(w->wr, &tail[4 - pad], pad + 4);
+
+  w->stats.packets++;
+  w->stats.bytes += cap_len;
+}  /* cap_add_pkt */
+
+
+/* Timestamp of the EPB at p. */
+static uint64_t cap_epb_ts(const char *p) {
+  const cap_epb_t *epb = (const cap_epb_t *)p;
+  return ((uint64_t)epb->ts_high << 32) | epb->ts_low;
+}  /* cap_epb_ts */
+
+
+/* Drop the oldest record from the flight recorder. */
+static void cap_pre_evict(cap_wkr_t *w) {
+  w->pre_tail += ((cap_epb_t *)(w->pre_buf + w->pre_tail))->len;
+  if (w->pre_wrap != 0 && w->pre_tail == w->pre_wrap) {
+    w->pre_tail = 0;
+    w->pre_wrap = 0;
+  }
+  w->stats.evicted++;
+}  /* cap_pre_evict */
+
+
+static int cap_pre_empty(cap_wkr_t *w) {
+  return w->pre_wrap == 0 && w->pre_tail == w->pre_head;
+}  /* cap_pre_empty */
+
+
+/* Copy one packet into the flight recorder as a complete EPB, evicting
+ * the oldest packets as needed for space and to keep within pre_ns. */
+static void cap_pre_add(cap_wkr_t *w, uint64_t ts_ns, const char *data, uint32_t cap_len, uint32_t orig_len) {
+  uint32_t pad = (4 - (cap_len & 3)) & 3;
+  uint32_t len = (uint32_t)sizeof(cap_epb_t) + cap_len + pad + 4;
+  cap_epb_t *epb;
+  char *p;
+
+  if (len > w->pre_size) { w->stats.evicted++;  return; }
+
+  while (!cap_pre_empty(w) && w->pre_ns != 0 &&
+      cap_epb_ts(w->pre_buf + w->pre_tail) + w->pre_ns < ts_ns) {
+    cap_pre_evict(w);
+  }
+  if (cap_pre_empty(w)) {
+    w->pre_head = w->pre_tail = 0;
+  }
+
+  /* Find room at pre_head: wrap if it doesn't fit before the end, and
+   * evict records that are in the way. */
+  while (1) {
+    if (w->pre_wrap == 0) {
+      if (w->pre_head + len <= w->pre_size) { break; }
+      w->pre_wrap = w->pre_head;
+      w->pre_head = 0;
+    }
+    if (w->pre_head + len <= w->pre_tail) { break; }
+    cap_pre_evict(w);
+  }
+
+  p = w->pre_buf + w->pre_head;
+  epb = (cap_epb_t *)p;
+  epb->type = PCAPNG_EPB;
+  epb->len = len;
+  epb->if_id = 0;
+  epb->ts_high = (uint32_t)(ts_ns >> 32);
+  epb->ts_low = (uint32_t)ts_ns;
+  epb->cap_len = cap_len;
+  epb->orig_len = orig_len;
+  memcpy(p + sizeof(cap_epb_t), data, cap_len);
+  memset(p + sizeof(cap_epb_t) + cap_len, 0, pad);
+  memcpy(p + len - 4, &len, 4);
+  w->pre_head += len;
+}  /* cap_pre_add */
+
+
+/* Write the records in [from, to) of the flight recorder that are not
+ * past stop_ns.  Returns 1 if one past it was found. */
+static int cap_pre_write(cap_wkr_t *w, size_t from, size_t to, uint64_t stop_ns) {
+  size_t end = from;
+  int done = 0;
+
+  while (end < to) {
+    const cap_epb_t *epb = (const cap_epb_t *)(w->pre_buf + end);
+    if (cap_epb_ts((const char *)epb) > stop_ns) { done = 1;  break; }
+    w->stats.packets++;
+    w->stats.bytes += epb->cap_len;
+    end += epb->len;
+  }
+  capwr_write(w->wr, w->pre_buf + from, end - from);
+  return done;
+}  /* cap_pre_write */
+
+
+/* The stop time is known: write out the flight recorder; later packets
+ * go straight to the file. */
+static void cap_pre_flush(cap_wkr_t *w, uint64_t stop_ns) {
+  if (w->pre_wrap != 0) {
+    if (!cap_pre_write(w, w->pre_tail, w->pre_wrap, stop_ns)) {
+      cap_pre_write(w, 0, w->pre_head, stop_ns);
+    }
+  } else {
+    cap_pre_write(w, w->pre_tail, w->pre_head, stop_ns);
+  }
+  w->pre_head = w->pre_tail = w->pre_wrap = 0;
+  w->recording = 0;
+}  /* cap_pre_flush */
+
+
+/* This thread's stop time (0 = none yet). */
+static uint64_t cap_stop_ns(cap_wkr_t *w) {
+  int gen = w->cap->gen;
+  uint64_t stop_ns;
+
+  __sync_synchronize();  /* See cap_rotate_wait. */
+  stop_ns = w->cap->stop_wall_ns;
+  __sync_synchronize();  /* next_wr was set before the stop time. */
+  return (gen == w->gen) ? stop_ns : 0;
+}  /* cap_stop_ns */
+
+
+/* Packets past stop_ns go to next_wr from now on. */
+static void cap_wkr_rotate(cap_wkr_t *w, uint64_t stop_ns) {
+  uint64_t cpu_ns = plat_thread_cpu_ns();
+
+  if (w->recording) { cap_pre_flush(w, stop_ns); }
+  w->gen_stats = w->stats;
+  w->gen_stats.cpu_ns = cpu_ns - w->cpu_mark;
+  w->cpu_mark = cpu_ns;
+  memset(&w->stats, 0, sizeof(w->stats));
+
+  w->old_wr = w->wr;
+  w->wr = w->next_wr;
+  w->next_wr = NULL;
+  /* The flight recorder starts over for the next trigger. */
+  w->recording = (w->pre_buf != NULL);
+  w->gen++;
+  __sync_synchronize();
+  w->rotated = 1;
+}  /* cap_wkr_rotate */
+
+
+/* Write one retired block's packets.  Returns 1 once a packet past the
+ * stop time is seen (every earlier one has then been written), unless
+ * rotating to a new file, which then gets that packet and the rest. */
+static int cap_block(cap_wkr_t *w, struct tpacket_block_desc *bd) {
+  struct tpacket3_hdr *ph;
+  struct sockaddr_ll *sll;
+  uint64_t stop_ns = cap_stop_ns(w);
+  uint64_t ts_ns;
+  uint32_t i;
+  int done = 0;
+
+  ph = (struct tpacket3_hdr *)((char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+  for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+    ts_ns = (uint64_t)ph->tp_sec * 1000000000 + ph->tp_nsec;
+    sll = (struct sockaddr_ll *)((char *)ph + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (stop_ns != 0 && ts_ns > stop_ns && w->next_wr != NULL) {
+      cap_wkr_rotate(w, stop_ns);
+      stop_ns = 0;
+    }
+    if (stop_ns != 0 && ts_ns > stop_ns) {
+      done = 1;
+    } else if (w->skip_outgoing && sll->sll_pkttype == PACKET_OUTGOING) {
+      /* Skip: the same packet comes back as incoming. */
+    } else if (w->recording) {
+      cap_pre_add(w, ts_ns, (char *)ph + ph->tp_mac, ph->tp_snaplen, ph->tp_len);
+    } else {
+      cap_add_pkt(w, ts_ns, (char *)ph + ph->tp_mac, ph->tp_snaplen, ph->tp_len);
+    }
+    ph = (struct tpacket3_hdr *)((char *)ph + ph->tp_next_offset);
+  }
+
+  return done;
+}  /* cap_block */
+
+
+static void *cap_thread(void *arg) {
+  cap_wkr_t *w = (cap_wkr_t *)arg;
+  struct tpacket_block_desc *bd;
+  struct pollfd pfd;
+  cpu_set_t cpus;
+  sigset_t all;
+  uint64_t stop_ns;
+
+  /* Signals are for the main thread (see plat_evl_add_signals). */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  if (w->cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(w->cpu, &cpus);
+    E(sched_setaffinity(0, sizeof(cpus), &cpus) != 0);
+  }
+
+  pfd.fd = w->sock;
+  pfd.events = POLLIN | POLLERR;
+  while (1) {
+    stop_ns = cap_stop_ns(w);
+    if (w->recording && stop_ns != 0) {
+      cap_pre_flush(w, stop_ns);
+    }
+    bd = (struct tpacket_block_desc *)(w->ring + (size_t)w->cur_block * CAP_BLOCK_SIZE);
+    if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+      /* A block holding a packet from before the stop time is retired
+       * within CAP_RETIRE_MS of it, so after twice that we have them all. */
+      if (stop_ns != 0 && plat_wall_ns() > stop_ns + 2000000ULL * CAP_RETIRE_MS) {
+        if (w->next_wr == NULL) { break; }
+        cap_wkr_rotate(w, stop_ns);
+      }
+      pfd.revents = 0;
+      poll(&pfd, 1, CAP_RETIRE_MS);
+      continue;
+    }
+
+    __sync_synchronize();  /* Read the block only after seeing its status. */
+    if (cap_block(w, bd)) { break; }
+    __sync_synchronize();
+    bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    w->cur_block = (w->cur_block + 1) % CAP_NUM_BLOCKS;
+  }
+
+  w->stats.cpu_ns = plat_thread_cpu_ns() - w->cpu_mark;
+  return NULL;
+}  /* cap_thread */
+
+
+/* Section header and interface description blocks. */
+static void cap_write_header(capwr_t *wr, const char *iface) {
+  unsigned char buf[256];
+  uint32_t u32, name_len, opts_len;
+  uint16_t u16;
+  size_t off = 0;
+
+#define PUT(p_, n_) do { memcpy(buf + off, (p_), (n_)); off += (n_); } while (0)
+  u32 = PCAPNG_SHB;  PUT(&u32, 4);
+  u32 = 28;  PUT(&u32, 4);
+  u32 = 0x1A2B3C4D;  PUT(&u32, 4);  /* Byte order magic. */
+  u16 = 1;  PUT(&u16, 2);  /* Version 1.0. */
+  u16 = 0;  PUT(&u16, 2);
+  u32 = 0xFFFFFFFF;  PUT(&u32, 4);  PUT(&u32, 4);  /* Section length unknown. */
+  u32 = 28;  PUT(&u32, 4);
+
+  name_len = (uint32_t)strlen(iface);
+  opts_len = 4 + ((name_len + 3) & ~3U) + 4 + 4 + 4;  /* if_name, if_tsresol, end. */
+  u32 = PCAPNG_IDB;  PUT(&u32, 4);
+  u32 = 20 + opts_len;  PUT(&u32, 4);
+  u16 = PCAPNG_LINKTYPE_ETHERNET;  PUT(&u16, 2);
+  u16 = 0;  PUT(&u16, 2);
+  u32 = CAP_SNAPLEN;  PUT(&u32, 4);
+  u16 = 2;  PUT(&u16, 2);  /* if_name */
+  u16 = (uint16_t)name_len;  PUT(&u16, 2);
+  PUT(iface, name_len);
+  memset(buf + off, 0, 3);  off += (4 - (name_len & 3)) & 3;
+  u16 = 9;  PUT(&u16, 2);  /* if_tsresol: 10^-9, i.e. nanoseconds. */
+  u16 = 1;  PUT(&u16, 2);
+  u32 = 9;  PUT(&u32, 4);  /* One byte of value, three of padding. */
+  u32 = 0;  PUT(&u32, 4);  /* opt_endofopt */
+  u32 = 20 + opts_len;  PUT(&u32, 4);
+#undef PUT
+
+  capwr_write(wr, buf, off);
+}  /* cap_write_header */
+
+
+/* Open one capture thread's socket and ring, and its output file. */
+static void cap_wkr_open(cap_wkr_t *w, const cap_cfg_t *cfg, int fanout_arg) {
+  struct tpacket_req3 req;
+  struct sockaddr_ll addr;
+  struct ifreq ifr;
+  int version = TPACKET_V3;
+  int rc;
+
+  if (cfg->pre_bytes > 0) {
+    /* The threads share the flight recorder budget. */
+    w->pre_size = cfg->pre_bytes / w->cap->num_wkrs;
+    w->pre_ns = cfg->pre_ns;
+    w->pre_buf = (char *)malloc(w->pre_size);  E(w->pre_buf == NULL);
+    w->recording = 1;
+    /* Fault the pages in now rather than while capturing. */
+    memset(w->pre_buf, 0, w->pre_size);
+  }
+
+  w->sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));  E(w->sock < 0);
+  rc = setsockopt(w->sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version));  E(rc != 0);
+  if (cfg->filter != NULL) {
+    /* Before bind, so that no unfiltered packet gets in. */
+    struct sock_fprog fprog;
+    fprog.len = (unsigned short)cfg->filter->len;
+    fprog.filter = (struct sock_filter *)cfg->filter->insns;
+    rc = setsockopt(w->sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));  E(rc != 0);
+  }
+
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = CAP_BLOCK_SIZE;
+  req.tp_block_nr = CAP_NUM_BLOCKS;
+  req.tp_frame_size = CAP_FRAME_SIZE;
+  req.tp_frame_nr = (CAP_BLOCK_SIZE / CAP_FRAME_SIZE) * CAP_NUM_BLOCKS;
+  req.tp_retire_blk_tov = CAP_RETIRE_MS;
+  rc = setsockopt(w->sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));  E(rc != 0);
+  w->ring = (char *)mmap(NULL, (size_t)CAP_BLOCK_SIZE * CAP_NUM_BLOCKS,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, w->sock, 0);
+  E(w->ring == MAP_FAILED);
+
+  memset(&ifr, 0, sizeof(ifr));
+  strcpy(ifr.ifr_name, cfg->iface);
+  rc = ioctl(w->sock, SIOCGIFHWADDR, &ifr);  E(rc != 0);
+  w->skip_outgoing = (ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = (int)if_nametoindex(cfg->iface);  E(addr.sll_ifindex == 0);
+  rc = bind(w->sock, (struct sockaddr *)&addr, sizeof(addr));  E(rc != 0);
+
+  if (fanout_arg != 0) {
+    rc = setsockopt(w->sock, SOL_PACKET, PACKET_FANOUT, &fanout_arg, sizeof(fanout_arg));  E(rc != 0);
+  }
+
+  /* Shards are compressed, if at all, when they are merged. */
+  w->wr = capwr_open(w->path, cfg->direct, (w->cap->num_wkrs > 1) ? 0 : cfg->compress);
+  cap_write_header(w->wr, cfg->iface);
+}  /* cap_wkr_open */
+
+
+cap_t *cap_open(const cap_cfg_t *cfg) {
+  int num_wkrs = (cfg->threads > 0) ? cfg->threads : 1;
+  int fanout_arg = 0;
+  size_t path_len;
+  cap_t *cap;
+  int i;
+
+  E(strlen(cfg->iface) >= IFNAMSIZ);
+  cap = (cap_t *)calloc(1, sizeof(cap_t));  E(cap == NULL);
+  cap->path = strdup(cfg->path);  E(cap->path == NULL);
+  cap->iface = strdup(cfg->iface);  E(cap->iface == NULL);
+  cap->direct = cfg->direct;
+  cap->compress = cfg->compress;
+  cap->num_wkrs = num_wkrs;
+  cap->wkrs = (cap_wkr_t *)calloc(num_wkrs, sizeof(cap_wkr_t));  E(cap->wkrs == NULL);
+
+  if (num_wkrs > 1) {
+    /* The kernel spreads packets over the group's sockets: by flow hash
+     * (keeping each flow, and its fragments, on one thread) or by the
+     * CPU that received them.  The group id only has to be unique among
+     * this host's fanout groups. */
+    fanout_arg = (getpid() & 0xffff) |
+        ((cfg->fanout_cpu ? PACKET_FANOUT_CPU : (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG)) << 16);
+  }
+
+  path_len = strlen(cfg->path) + 16;
+  for (i = 0; i < num_wkrs; i++) {
+    cap_wkr_t *w = &cap->wkrs[i];
+    w->cap = cap;
+    w->cpu = (cfg->cpus != NULL) ? cfg->cpus[i] : -1;
+    w->path = (char *)malloc(path_len);  E(w->path == NULL);
+    if (num_wkrs == 1) {
+      strcpy(w->path, cfg->path);
+    } else {
+      snprintf(w->path, path_len, "%s.shard%d", cfg->path, i);
+    }
+    cap_wkr_open(w, cfg, fanout_arg);
+  }
+  for (i = 0; i < num_wkrs; i++) {
+    E(plat_thread_create(&cap->wkrs[i].thr, cap_thread, &cap->wkrs[i]));
+  }
+
+  return cap;
+}  /* cap_open */
+
+
+void cap_stop_at(cap_t *cap, uint64_t stop_wall_ns) {
+  cap->stop_wall_ns = stop_wall_ns;
+}  /* cap_stop_at */
+
+
+/* Merge the threads' shard files into cap->path in timestamp order
+ * (each shard already is), then remove them.  The shards are mapped and
+ * their EPBs copied straight to a writer (which compresses, if asked). */
+static void cap_merge(cap_t *cap, capwr_stats_t *wr_stats) {
+  char **base, **pos, **end;
+  struct stat st;
+  capwr_t *wr;
+  uint32_t len;
+  int fd, i, best;
+  uint64_t ts, best_ts;
+
+  base = (char **)calloc(cap->num_wkrs * 3, sizeof(char *));  E(base == NULL);
+  pos = base + cap->num_wkrs;
+  end = pos + cap->num_wkrs;
+  for (i = 0; i < cap->num_wkrs; i++) {
+    fd = open(cap->wkrs[i].path, O_RDONLY);  E(fd < 0);
+    E(fstat(fd, &st) != 0);
+    base[i] = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);  E(base[i] == MAP_FAILED);
+    close(fd);
+    end[i] = base[i] + st.st_size;
+    /* Skip the section header and interface description blocks. */
+    pos[i] = base[i] + ((cap_epb_t *)base[i])->len;
+    pos[i] += ((cap_epb_t *)pos[i])->len;
+  }
+
+  wr = capwr_open(cap->path, cap->direct, cap->compress);
+  /* Same headers as any shard. */
+  capwr_write(wr, base[0], pos[0] - base[0]);
+
+  while (1) {
+    best = -1;
+    best_ts = 0;
+    for (i = 0; i < cap->num_wkrs; i++) {
+      if (pos[i] >= end[i]) { continue; }
+      ts = cap_epb_ts(pos[i]);
+      if (best == -1 || ts < best_ts) { best = i;  best_ts = ts; }
+    }
+    if (best == -1) { break; }
+    len = ((cap_epb_t *)pos[best])->len;
+    capwr_write(wr, pos[best], len);
+    pos[best] += len;
+  }
+  capwr_close(wr, wr_stats);
+
+  for (i = 0; i < cap->num_wkrs; i++) {
+    munmap(base[i], end[i] - base[i]);
+    unlink(cap->wkrs[i].path);
+  }
+  free(base);
+}  /* cap_merge */
+
+
+/* Add one writer's stats to *st. */
+static void cap_add_wr_stats(cap_stats_t *st, const capwr_stats_t *ws) {
+  st->wr.bytes_in += ws->bytes_in;
+  st->wr.bytes_out += ws->bytes_out;
+  st->wr.write_ns += ws->write_ns;
+  st->wr.cpu_ns += ws->cpu_ns;
+  st->wr.stalls += ws->stalls;
+  if (ws->queue_hwm > st->wr.queue_hwm) { st->wr.queue_hwm = ws->queue_hwm; }
+  st->wr.queue_size = ws->queue_size;
+}  /* cap_add_wr_stats */
+
+
+/* Finish a worker's (old) file: add its writer's counters and the
+ * kernel's drops (since the last read) to *st, and add that to *total. */
+static void cap_wkr_finish(cap_wkr_t *w, capwr_t *wr, cap_stats_t *st, cap_stats_t *total) {
+  struct tpacket_stats_v3 kstats;
+  capwr_stats_t wr_stats;
+  socklen_t len;
+
+  capwr_close(wr, &wr_stats);
+  cap_add_wr_stats(st, &wr_stats);
+  st->cpu_ns += wr_stats.cpu_ns;
+
+  len = sizeof(kstats);
+  memset(&kstats, 0, sizeof(kstats));
+  if (getsockopt(w->sock, SOL_PACKET, PACKET_STATISTICS, &kstats, &len) == 0) {
+    st->drops = kstats.tp_drops;
+  }
+  if (total != NULL) {
+    total->packets += st->packets;
+    total->bytes += st->bytes;
+    total->drops += st->drops;
+    total->evicted += st->evicted;
+    total->cpu_ns += st->cpu_ns;
+    cap_add_wr_stats(total, &st->wr);
+    /* The only thread's file (else cap_finish_file overrides it). */
+    total->file_bytes = wr_stats.bytes_out;
+    total->file_raw_bytes = wr_stats.bytes_in;
+  }
+}  /* cap_wkr_finish */
+
+
+/* Merge the shards of the file just finished, if there are any. */
+static void cap_finish_file(cap_t *cap, cap_stats_t *total) {
+  capwr_stats_t wr_stats;
+
+  if (cap->num_wkrs == 1) { return; }
+  cap_merge(cap, &wr_stats);
+  if (total != NULL) {
+    /* Its queue waits hold up only the merge, not capturing. */
+    total->wr.bytes_in += wr_stats.bytes_in;
+    total->wr.bytes_out += wr_stats.bytes_out;
+    total->wr.write_ns += wr_stats.write_ns;
+    total->wr.cpu_ns += wr_stats.cpu_ns;
+    total->cpu_ns += wr_stats.cpu_ns;
+    total->file_bytes = wr_stats.bytes_out;
+    total->file_raw_bytes = wr_stats.bytes_in;
+  }
+}  /* cap_finish_file */
+
+
+void cap_rotate_at(cap_t *cap, uint64_t stop_wall_ns, const char *next_path) {
+  size_t path_len = strlen(next_path) + 16;
+  int i;
+
+  E(cap->next_path != NULL);  /* Previous rotation not waited for. */
+  cap->next_path = strdup(next_path);  E(cap->next_path == NULL);
+  for (i = 0; i < cap->num_wkrs; i++) {
+    cap_wkr_t *w = &cap->wkrs[i];
+    capwr_t *wr;
+
+    w->next_path = (char *)malloc(path_len);  E(w->next_path == NULL);
+    if (cap->num_wkrs == 1) {
+      strcpy(w->next_path, next_path);
+    } else {
+      snprintf(w->next_path, path_len, "%s.shard%d", next_path, i);
+    }
+    wr = capwr_open(w->next_path, cap->direct, (cap->num_wkrs > 1) ? 0 : cap->compress);
+    cap_write_header(wr, cap->iface);
+    w->next_wr = wr;
+  }
+  __sync_synchronize();  /* See cap_stop_ns. */
+  cap->stop_wall_ns = stop_wall_ns;
+}  /* cap_rotate_at */
+
+
+void cap_rotate_wait(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread) {
+  int i;
+
+  if (total != NULL) { memset(total, 0, sizeof(*total)); }
+  for (i = 0; i < cap->num_wkrs; i++) {
+    cap_wkr_t *w = &cap->wkrs[i];
+
+    /* Within 2 * CAP_RETIRE_MS of the stop time (see cap_thread). */
+    while (!w->rotated) { plat_sleep_ms(1); }
+    __sync_synchronize();
+    cap_wkr_finish(w, w->old_wr, &w->gen_stats, total);
+    w->old_wr = NULL;
+    if (per_thread != NULL) { per_thread[i] = w->gen_stats; }
+  }
+  cap_finish_file(cap, total);
+
+  for (i = 0; i < cap->num_wkrs; i++) {
+    cap_wkr_t *w = &cap->wkrs[i];
+    free(w->path);
+    w->path = w->next_path;
+    w->next_path = NULL;
+    w->rotated = 0;
+  }
+  free(cap->path);
+  cap->path = cap->next_path;
+  cap->next_path = NULL;
+
+  /* The threads are on the next generation; give them its stop time
+   * (none yet). */
+  cap->stop_wall_ns = 0;
+  __sync_synchronize();
+  cap->gen++;
+}  /* cap_rotate_wait */
+
+
+void cap_close(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread) {
+  int i;
+
+  /* A rotation in progress (interrupted) finishes first. */
+  if (cap->next_path != NULL) { cap_rotate_wait(cap, NULL, NULL); }
+  if (cap->stop_wall_ns == 0) { cap->stop_wall_ns = plat_wall_ns(); }
+  if (total != NULL) { memset(total, 0, sizeof(*total)); }
+
+  for (i = 0; i < cap->num_wkrs; i++) {
+    cap_wkr_t *w = &cap->wkrs[i];
+    plat_thread_join(w->thr);
+    cap_wkr_finish(w, w->wr, &w->stats, total);
+    if (per_thread != NULL) { per_thread[i] = w->stats; }
+
+    free(w->pre_buf);
+    munmap(w->ring, (size_t)CAP_BLOCK_SIZE * CAP_NUM_BLOCKS);
+    close(w->sock);
+  }
+  cap_finish_file(cap, total);
+
+  for (i = 0; i < cap->num_wkrs; i++) {
+    free(cap->wkrs[i].path);
+  }
+  free(cap->wkrs);
+  free(cap->path);
+  free(cap->iface);
+  free(cap);
+}  /* cap_close */
+
+#else  /* not __linux__ */
+
+cap_t *cap_open(const cap_cfg_t *cfg) {
+  (void)cfg;
+  return NULL;
+}  /* cap_open */
+
+
+void cap_stop_at(cap_t *cap, uint64_t stop_wall_ns) {
+  (void)cap;  (void)stop_wall_ns;
+}  /* cap_stop_at */
+
+
+void cap_rotate_at(cap_t *cap, uint64_t stop_wall_ns, const char *next_path) {
+  (void)cap;  (void)stop_wall_ns;  (void)next_path;
+}  /* cap_rotate_at */
+
+
+void cap_rotate_wait(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread) {
+  (void)cap;  (void)total;  (void)per_thread;
+}  /* cap_rotate_wait */
+
+
+void cap_close(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread) {
+  (void)cap;  (void)total;  (void)per_thread;
+}  /* cap_close */
+
+#endif  /* __linux__ */
@@ -0,0 +1,89 @@
+/* cap.h - In-process packet capture for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef CAP_H
+#define CAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bpf.h"
+#include "capwr.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Opaque capture (AF_PACKET TPACKET_V3 ring on Linux; not available
+ * elsewhere). */
+typedef struct cap_s cap_t;
+
+/* Bytes of each packet kept (compile capture filters with this). */
+#define CAP_SNAPLEN 262144
+
+typedef struct cap_cfg_s {
+  const char *iface;
+  const char *path;      /* pcapng output. */
+  size_t pre_bytes;      /* Flight recorder RAM (0 = write packets as they come). */
+  uint64_t pre_ns;       /* Flight recorder window (0 = as much as fits). */
+  int threads;           /* Capture threads (0 or 1 = one). */
+  int fanout_cpu;        /* Spread packets over threads by CPU, not flow hash. */
+  const int *cpus;       /* Per thread: CPU to pin it to, or NULL. */
+  const bpf_prog_t *filter;  /* Run in the kernel on each packet, or NULL. */
+  int direct;            /* Write the file with O_DIRECT where allowed. */
+  int compress;          /* gzip level (1-9) for the file, or 0. */
+} cap_cfg_t;
+
+typedef struct cap_stats_s {
+  uint64_t packets;  /* Packets written. */
+  uint64_t bytes;    /* Packet bytes written (not counting pcapng framing). */
+  uint64_t drops;    /* Packets the kernel dropped because the ring was full. */
+  uint64_t evicted;  /* Packets aged out of the flight recorder. */
+  uint64_t cpu_ns;   /* CPU time used by the capture and writer threads. */
+  capwr_stats_t wr;  /* File writer(s); queue_hwm is the highest. */
+  uint64_t file_bytes;      /* Size of the finished file (total only). */
+  uint64_t file_raw_bytes;  /* The same, uncompressed. */
+} cap_stats_t;
+
+
+/* Start capturing every packet on cfg->iface into a pcapng file at
+ * cfg->path, by a capture thread (and a writer thread for the file).
+ * With more than one thread, each writes its own shard file
+ * (path.shard<N>) until cap_close merges them.  With pre_bytes set,
+ * packets are instead kept in a RAM "flight recorder" (the newest
+ * pre_bytes, and at most pre_ns old) until cap_stop_at, and only then
+ * written, followed by the rest up to the stop time.  Returns NULL if
+ * not supported here. */
+cap_t *cap_open(const cap_cfg_t *cfg);
+/* Stop at stop_wall_ns (plat_wall_ns clock): packets with later
+ * timestamps are not written.  Doesn't wait. */
+void cap_stop_at(cap_t *cap, uint64_t stop_wall_ns);
+/* Like cap_stop_at, but packets past the stop time go to a new file at
+ * next_path (opened now, sharded like the first) instead of being
+ * dropped, and capturing carries on; with pre_bytes, they go to the
+ * flight recorder again until the next stop time.  Doesn't wait. */
+void cap_rotate_at(cap_t *cap, uint64_t stop_wall_ns, const char *next_path);
+/* Wait for the rotation to reach every thread and finish the previous
+ * file (merging its shards).  Fills *total and per_thread[] with that
+ * file's counters if not NULL.  Then cap_rotate_at can be called again. */
+void cap_rotate_wait(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread);
+/* Wait for every packet up to the stop time (now, if cap_stop_at wasn't
+ * called) to be written, then close.  Fills *total and per_thread[] (one
+ * per thread) if not NULL. */
+void cap_close(cap_t *cap, cap_stats_t *total, cap_stats_t *per_thread);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAP_H */
@@ -0,0 +1,58 @@
+#!/bin/bash
+# cap_bench.sh - Capture CPU with and without cap_filter, at a fixed
+#   packet rate on lo.  Needs root on Linux.
+# Usage: ./cap_bench.sh [packets_per_sec [seconds [filter]]]
+
+RATE=${1:-100000}
+SECS=${2:-5}
+FILTER=${3:-tcp port 9877}
+
+./bld.sh;  if [ "$?" -ne 0 ]; then exit 1; fi
+gcc -Wall -O2 -o udp_gen udp_gen.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+
+echo "old line" >bench1.log
+echo "old line" >bench2.log
+
+cat >bench_init.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=bench2.log
+__EOF__
+
+# run_one <label> [cap_filter]
+run_one() {
+  cat >bench_listen.cfg <<__EOF__
+listen_port=9877
+mon_file=bench1.log
+cap_iface=lo
+cap_file=bench.pcapng
+stats_file=bench_stats.json
+__EOF__
+  if [ -n "$2" ]; then echo "cap_filter=$2" >>bench_listen.cfg; fi
+  rm -f bench.pcapng bench_stats.json
+
+  ./dual_cap bench_listen.cfg 2>/dev/null &
+  LISTENER_PID=$!
+  sleep 0.5
+  ./dual_cap bench_init.cfg 2>/dev/null &
+  INITIATOR_PID=$!
+  sleep 0.5
+
+  ./udp_gen 127.0.0.1 9 $RATE $SECS 100 >/dev/null
+
+  echo "test" >>bench1.log
+  wait $LISTENER_PID $INITIATOR_PID
+
+  CPU_NS=`sed -n 's/.*"cap_cpu_ns": \([0-9]*\).*/\1/p' bench_stats.json`
+  PACKETS=`sed -n 's/.*"cap_packets": \([0-9]*\).*/\1/p' bench_stats.json`
+  DROPS=`sed -n 's/.*"cap_drops": \([0-9]*\).*/\1/p' bench_stats.json`
+  # CPU percentage is over the traffic time (the run is about 1 s longer).
+  awk -v label="$1" -v rate=$RATE -v secs=$SECS -v cpu_ns=$CPU_NS -v pkts=$PACKETS -v drops=$DROPS 'BEGIN {
+    printf("%-28s rate=%d pps  cap_cpu_ms=%.1f (%.2f%% of a CPU)  cap_packets=%d  cap_drops=%d\n",
+      label, rate, cpu_ns / 1e6, 100 * cpu_ns / (secs * 1e9), pkts, drops) }'
+}  # run_one
+
+run_one "no filter"
+run_one "cap_filter='$FILTER'" "$FILTER"
+
+rm -f bench1.log bench2.log bench_listen.cfg bench_init.cfg bench.pcapng bench_stats.json
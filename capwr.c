@@ -0,0 +1,298 @@
+/* capwr.c - Asynchronous batched capture file writer for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* For O_DIRECT. */
+#endif
+#include "plat.h"
+#include "capwr.h"
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <errno.h>
+#include <semaphore.h>
+#ifdef CAPWR_ZLIB
+#include <zlib.h>
+#endif
+
+/* Batches are page-aligned and a multiple of any disk block size, so
+ * that full ones can be written with O_DIRECT. */
+#define CAPWR_BATCH_SIZE (1024 * 1024)
+#define CAPWR_NUM_BATCHES 8
+#define CAPWR_ALIGN 4096
+
+/* The batches form a single-producer single-consumer ring.  The producer
+ * fills batch[head % N] and hands it off by advancing head and posting
+ * "full"; the writer writes batch[tail % N] and gives it back by
+ * advancing tail and posting "empty".  The semaphores only make a
+ * syscall when the other side is asleep. */
+struct capwr_s {
+  int fd;
+  int direct;          /* fd has O_DIRECT set. */
+  char *batch[CAPWR_NUM_BATCHES];
+  size_t batch_len[CAPWR_NUM_BATCHES];
+  volatile unsigned head;  /* Batches handed off (producer). */
+  volatile unsigned tail;  /* Batches written (writer). */
+  int have_batch;      /* Producer owns batch[head % N]. */
+  size_t fill;         /* Bytes in it. */
+  sem_t full;
+  sem_t empty;
+  plat_thread_t thr;
+  capwr_stats_t stats;
+#ifdef CAPWR_ZLIB
+  int compress;
+  z_stream zs;
+  char *zbuf;          /* Compressed output, written when full. */
+#endif
+};
+
+
+int capwr_can_compress(void) {
+#ifdef CAPWR_ZLIB
+  return 1;
+#else
+  return 0;
+#endif
+}  /* capwr_can_compress */
+
+
+static char *capwr_alloc(void) {
+  void *p;
+
+  E(posix_memalign(&p, CAPWR_ALIGN, CAPWR_BATCH_SIZE) != 0);
+  /* Fault the pages in now rather than while capturing. */
+  memset(p, 0, CAPWR_BATCH_SIZE);
+  return (char *)p;
+}  /* capwr_alloc */
+
+
+/* Writer thread: write len bytes.  O_DIRECT needs aligned lengths, so it
+ * is turned off for the last, partial, write. */
+static void capwr_out(capwr_t *wr, const char *p, size_t len) {
+  uint64_t start_ns = plat_monotonic_ns();
+  ssize_t rc;
+
+#ifdef O_DIRECT
+  if (wr->direct && (len % CAPWR_ALIGN) != 0) {
+    E(fcntl(wr->fd, F_SETFL, fcntl(wr->fd, F_GETFL) & ~O_DIRECT) != 0);
+    wr->direct = 0;
+  }
+#endif
+  while (len > 0) {
+    rc = write(wr->fd, p, len);  E(rc <= 0);
+    p += rc;
+    len -= rc;
+    wr->stats.bytes_out += rc;
+  }
+  wr->stats.write_ns += plat_monotonic_ns() - start_ns;
+}  /* capwr_out */
+
+
+#ifdef CAPWR_ZLIB
+/* Writer thread: compress len bytes (or finish the stream), writing
+ * zbuf whenever it fills. */
+static void capwr_deflate(capwr_t *wr, const char *p, size_t len, int flush) {
+  int rc;
+
+  wr->zs.next_in = (Bytef *)p;
+  wr->zs.avail_in = (uInt)len;
+  do {
+    rc = deflate(&wr->zs, flush);  E(rc == Z_STREAM_ERROR);
+    if (wr->zs.avail_out == 0 || flush == Z_FINISH) {
+      capwr_out(wr, wr->zbuf, CAPWR_BATCH_SIZE - wr->zs.avail_out);
+      wr->zs.next_out = (Bytef *)wr->zbuf;
+      wr->zs.avail_out = CAPWR_BATCH_SIZE;
+    }
+  } while (wr->zs.avail_in > 0 || (flush == Z_FINISH && rc != Z_STREAM_END));
+}  /* capwr_deflate */
+#endif
+
+
+static void *capwr_thread(void *arg) {
+  capwr_t *wr = (capwr_t *)arg;
+  sigset_t all;
+  unsigned i;
+
+  /* Signals are for the main thread (see plat_evl_add_signals). */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  while (1) {
+    while (sem_wait(&wr->full) != 0) { E(errno != EINTR); }
+    if (wr->tail == wr->head) { break; }  /* capwr_close's extra post. */
+    i = wr->tail % CAPWR_NUM_BATCHES;
+#ifdef CAPWR_ZLIB
+    if (wr->compress) {
+      capwr_deflate(wr, wr->batch[i], wr->batch_len[i], Z_NO_FLUSH);
+    } else
+#endif
+    {
+      capwr_out(wr, wr->batch[i], wr->batch_len[i]);
+    }
+    __sync_synchronize();  /* Done with the batch before giving it back. */
+    wr->tail++;
+    E(sem_post(&wr->empty) != 0);
+  }
+
+#ifdef CAPWR_ZLIB
+  if (wr->compress) {
+    capwr_deflate(wr, NULL, 0, Z_FINISH);
+  }
+#endif
+  wr->stats.cpu_ns = plat_thread_cpu_ns();
+  return NULL;
+}  /* capwr_thread */
+
+
+capwr_t *capwr_open(const char *path, int direct, int compress_level) {
+  capwr_t *wr;
+  int i;
+
+  wr = (capwr_t *)calloc(1, sizeof(capwr_t));  E(wr == NULL);
+  wr->fd = -1;
+#ifdef O_DIRECT
+  if (direct) {
+    wr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (wr->fd < 0 && errno == EINVAL) {
+      fprintf(stderr, "WARNING: '%s' does not allow O_DIRECT; writing it normally.\n", path);
+    }
+    wr->direct = (wr->fd >= 0);
+  }
+#else
+  (void)direct;
+#endif
+  if (wr->fd < 0) {
+    wr->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);  E(wr->fd < 0);
+  }
+
+  for (i = 0; i < CAPWR_NUM_BATCHES; i++) {
+    wr->batch[i] = capwr_alloc();
+  }
+  wr->stats.queue_size = CAPWR_NUM_BATCHES;
+  E(sem_init(&wr->full, 0, 0) != 0);
+  E(sem_init(&wr->empty, 0, CAPWR_NUM_BATCHES) != 0);
+
+  if (compress_level > 0) {
+#ifdef CAPWR_ZLIB
+    wr->compress = 1;
+    wr->zbuf = capwr_alloc();
+    /* windowBits 15 + 16: a gzip stream, which Wireshark reads as is. */
+    E(deflateInit2(&wr->zs, compress_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK);
+    wr->zs.next_out = (Bytef *)wr->zbuf;
+    wr->zs.avail_out = CAPWR_BATCH_SIZE;
+#else
+    E(compress_level > 0);  /* Check capwr_can_compress first. */
+#endif
+  }
+
+  E(plat_thread_create(&wr->thr, capwr_thread, wr));
+  return wr;
+}  /* capwr_open */
+
+
+/* Hand the current batch to the writer. */
+static void capwr_handoff(capwr_t *wr) {
+  unsigned queued;
+
+  wr->batch_len[wr->head % CAPWR_NUM_BATCHES] = wr->fill;
+  __sync_synchronize();  /* Batch contents before head. */
+  wr->head++;
+  queued = wr->head - wr->tail;
+  if ((int)queued > wr->stats.queue_hwm) { wr->stats.queue_hwm = (int)queued; }
+  E(sem_post(&wr->full) != 0);
+  wr->have_batch = 0;
+}  /* capwr_handoff */
+
+
+void capwr_write(capwr_t *wr, const void *data, size_t len) {
+  const char *p = (const char *)data;
+  size_t n;
+
+  wr->stats.bytes_in += len;
+  while (len > 0) {
+    if (!wr->have_batch) {
+      if (sem_trywait(&wr->empty) != 0) {
+        /* Every batch is queued: the disk isn't keeping up. */
+        wr->stats.stalls++;
+        while (sem_wait(&wr->empty) != 0) { E(errno != EINTR); }
+      }
+      wr->have_batch = 1;
+      wr->fill = 0;
+    }
+    n = CAPWR_BATCH_SIZE - wr->fill;
+    if (n > len) { n = len; }
+    memcpy(wr->batch[wr->head % CAPWR_NUM_BATCHES] + wr->fill, p, n);
+    wr->fill += n;
+    p += n;
+    len -= n;
+    if (wr->fill == CAPWR_BATCH_SIZE) { capwr_handoff(wr); }
+  }
+}  /* capwr_write */
+
+
+void capwr_close(capwr_t *wr, capwr_stats_t *stats) {
+  int i;
+
+  if (wr->have_batch && wr->fill > 0) { capwr_handoff(wr); }
+  E(sem_post(&wr->full) != 0);  /* No new batch: tells the writer to finish. */
+  plat_thread_join(wr->thr);
+
+#ifdef CAPWR_ZLIB
+  if (wr->compress) {
+    deflateEnd(&wr->zs);
+    free(wr->zbuf);
+  }
+#endif
+  close(wr->fd);
+  sem_destroy(&wr->full);
+  sem_destroy(&wr->empty);
+  for (i = 0; i < CAPWR_NUM_BATCHES; i++) {
+    free(wr->batch[i]);
+  }
+  if (stats != NULL) { *stats = wr->stats; }
+  free(wr);
+}  /* capwr_close */
+
+#else  /* not __linux__ */
+
+/* Only the in-process capture (cap.c, Linux only) writes through here. */
+
+int capwr_can_compress(void) {
+  return 0;
+}  /* capwr_can_compress */
+
+
+capwr_t *capwr_open(const char *path, int direct, int compress_level) {
+  (void)path;  (void)direct;  (void)compress_level;
+  return NULL;
+}  /* capwr_open */
+
+
+void capwr_write(capwr_t *wr, const void *data, size_t len) {
+  (void)wr;  (void)data;  (void)len;
+}  /* capwr_write */
+
+
+void capwr_close(capwr_t *wr, capwr_stats_t *stats) {
+  (void)wr;  (void)stats;
+}  /* capwr_close */
+
+#endif  /* __linux__ */
@@ -0,0 +1,55 @@
+/* capwr.h - Asynchronous batched capture file writer for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef CAPWR_H
+#define CAPWR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Opaque writer: one producer thread copies data into page-aligned
+ * batches, which a writer thread compresses (optionally) and writes. */
+typedef struct capwr_s capwr_t;
+
+typedef struct capwr_stats_s {
+  uint64_t bytes_in;    /* Bytes given to capwr_write. */
+  uint64_t bytes_out;   /* Bytes written to the file. */
+  uint64_t write_ns;    /* Time spent in write calls. */
+  uint64_t cpu_ns;      /* CPU time used by the writer thread. */
+  uint64_t stalls;      /* Times the producer waited for a free batch. */
+  int queue_hwm;        /* Most batches ever queued for writing. */
+  int queue_size;       /* Batches in all. */
+} capwr_stats_t;
+
+/* Returns 1 if capwr_open can compress (built with zlib). */
+int capwr_can_compress(void);
+/* Create (truncate) path.  direct: use O_DIRECT if the file system
+ * allows it.  compress_level: 1-9 for gzip, 0 for none. */
+capwr_t *capwr_open(const char *path, int direct, int compress_level);
+/* Copy len bytes into the current batch, handing it to the writer
+ * thread when full; waits only if every batch is queued. */
+void capwr_write(capwr_t *wr, const void *data, size_t len);
+/* Write what is left, wait for it, close the file and free wr.  Fills
+ * *stats if not NULL. */
+void capwr_close(capwr_t *wr, capwr_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPWR_H */
@@ -1,4 +1,4 @@
 #!/bin/sh
 # clean.sh
 
-rm -rf dual_cap *.log *.cfg x x.* *.x capdir[12]
+rm -rf dual_cap udp_gen re_gen re_gen_bench re_gen_pats.c re_gen_bench_pats.c bench log_gen *.log *.cfg stats*.json cap[0-9].pcapng* x x.* *.x capdir[12]
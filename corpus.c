@@ -0,0 +1,70 @@
+/* corpus.c - Log corpus loader for the benchmarks (bench.c,
+ *   re_gen_bench.c).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+
+corpus_t *corpus_load(const char *path) {
+  corpus_t *corpus = (corpus_t *)calloc(1, sizeof(corpus_t));  E(corpus == NULL);
+  FILE *fp = fopen(path, "rb");
+  long size;
+  int i, start, len, max_lines = 0;
+
+  if (fp == NULL) { perror(path); exit(1); }
+  E(fseek(fp, 0, SEEK_END) != 0);
+  size = ftell(fp);  E(size < 0 || size > INT_MAX - 1);
+  rewind(fp);
+  corpus->text = (char *)malloc(size + 1);  E(corpus->text == NULL);
+  E(fread(corpus->text, 1, size, fp) != (size_t)size);
+  fclose(fp);
+  corpus->size = (size_t)size;
+  corpus->text[size] = '\n';  /* Ends the last line, if unterminated. */
+
+  for (start = 0, i = 0; i <= size; i++) {
+    if (corpus->text[i] != '\n') { continue; }
+    if (i == size && start == size) { break; }  /* Ended with a newline. */
+    if (corpus->num_lines == max_lines) {
+      max_lines = (max_lines == 0) ? 1024 : max_lines * 2;
+      corpus->line_off = (int *)realloc(corpus->line_off, max_lines * sizeof(int));  E(corpus->line_off == NULL);
+      corpus->line_len = (int *)realloc(corpus->line_len, max_lines * sizeof(int));  E(corpus->line_len == NULL);
+    }
+    len = i - start;
+    while (len > 0 && corpus->text[start + len - 1] == '\r') {
+      len--;
+    }
+    corpus->line_off[corpus->num_lines] = start;
+    corpus->line_len[corpus->num_lines] = len;
+    corpus->num_lines++;
+    start = i + 1;
+  }
+  return corpus;
+}  /* corpus_load */
+
+
+void corpus_free(corpus_t *corpus) {
+  free(corpus->text);
+  free(corpus->line_off);
+  free(corpus->line_len);
+  free(corpus);
+}  /* corpus_free */
@@ -0,0 +1,43 @@
+/* corpus.h - Log corpus loader for the benchmarks (bench.c,
+ *   re_gen_bench.c).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* A log file in memory, split into lines. */
+typedef struct corpus_s {
+  char *text;        /* The file, plus a newline after its end. */
+  size_t size;       /* File size (without that newline). */
+  int *line_off;     /* Per line: start in text. */
+  int *line_len;     /* Per line: length, without newline or cr. */
+  int num_lines;
+} corpus_t;
+
+
+/* Read a whole file (under 2 GB).  Exits on error. */
+corpus_t *corpus_load(const char *path);
+void corpus_free(corpus_t *corpus);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CORPUS_H */
@@ -13,6 +13,10 @@
 
 #include "plat.h"
 #include "re.h"
+#include "mpat.h"
+#include "mwork.h"
+#include "mon.h"
+#include "cap.h"
 
 #define E(e_expr_) do { \
   if (e_expr_) { \
@@ -21,26 +25,172 @@
   } \
 } while (0)
 
+#ifdef RE_GEN_PATTERNS
+/* Matchers generated by re_gen (see bld.sh). */
+extern const re_gen_entry_t re_gen_patterns[];
+#endif
+
+/* Event loop ids other than peers (which use their index). */
+#define EV_ID_MON  (-1)
+#define EV_ID_WAKE (-2)
+#define EV_ID_SIG  (-3)
+#define EV_ID_MCAST (-4)
+#define EV_ID_LISTEN (-5)
+
+/* Multicast mode: each trigger datagram is sent this many times, 1 ms
+ * apart, in case some are lost. */
+#define MCAST_REPEAT 3
+
+/* Peer clock estimation: keep this many recent ping samples, taking the
+ * first ones this many ms apart (then every ping_interval_ms). */
+#define PING_SAMPLES 8
+#define PING_FAST_MS 10
+
+/* Initiator (re)connect: retry after a failure with exponential backoff
+ * between these bounds, giving up on an attempt after CONNECT_TIMEOUT_MS.
+ * A connect in progress is checked every CONNECT_POLL_MS. */
+#define RECONNECT_MIN_MS 100
+#define RECONNECT_MAX_MS 5000
+#define CONNECT_TIMEOUT_MS 2000
+#define CONNECT_POLL_MS 10
+
+/* One mon_file config entry (a path or glob) and the mon_pattern(s)
+ * that follow it. */
+typedef struct cfg_mon_spec_s {
+  char *path;
+  mpat_t *patterns;  /* NULL if none; then the default patterns apply. */
+} cfg_mon_spec_t;
+
+/* One peer.  Its connection is up when sock is valid and not still
+ * connecting; when it drops, the initiator reconnects and the listener
+ * accepts a new one in its place. */
+typedef struct peer_s {
+  plat_sock_t sock;  /* PLAT_INVALID_SOCK while down. */
+  int connecting;    /* Initiator: sock is a connect in progress. */
+  char name[64];     /* "ip:port", for reports. */
+  uint64_t sent_ns;  /* When we sent it "exit" (0 = not yet). */
+  uint64_t recv_ns;  /* When it sent "exit" (0 = not yet). */
+  int gone;          /* It said "bye" (exited); not coming back. */
+  uint64_t last_recv_ns;  /* Last data from it (heartbeat timeout). */
+  uint64_t last_hb_ns;    /* Last heartbeat sent to it. */
+  uint64_t retry_ns;      /* Initiator, while down: next connect attempt. */
+  uint64_t connect_ns;    /* Initiator: when the attempt started. */
+  int backoff_ms;
+  int attempts;      /* Failed connect attempts in a row. */
+  int connects;      /* Times connected (reconnects = connects - 1). */
+  uint64_t missed_hbs;    /* Heartbeat intervals with nothing from it. */
+  char rbuf[256];    /* Received data not yet handled (partial line). */
+  int rlen;
+  uint64_t next_ping_ns;
+  int pings_sent;
+  /* Last PING_SAMPLES clock samples (ring): offset is the peer's wall
+   * clock minus ours. */
+  int64_t ping_offset[PING_SAMPLES];
+  uint64_t ping_rtt[PING_SAMPLES];
+  int num_pings;     /* Samples taken in total. */
+} peer_t;
+
+/* Trigger path timestamps (plat_monotonic_ns; 0 = didn't happen) and
+ * counters for the end-of-run report. */
+typedef struct stats_s {
+  uint64_t start_ns;     /* Monitoring started. */
+  uint64_t observed_ns;  /* Log data holding the trigger line was read. */
+  uint64_t matched_ns;   /* Trigger line matched (local trigger). */
+  uint64_t sent_ns;      /* Trigger first sent to peer(s). */
+  uint64_t kill_ns;      /* Capture stop issued. */
+  uint64_t cap_exit_ns;  /* Capture process exited. */
+  uint64_t scan_cpu_ns;  /* CPU time spent splitting and matching lines. */
+  uint64_t kill_wall_ns; /* Capture stop issued (wall clock). */
+  mon_file_t *trigger_file;  /* File whose line matched. */
+  int trigger_pat;       /* Index of the pattern that matched (-1 = any line). */
+  /* The rule that fired, "<key> <n> [<count>/<ms> <seen> <span_ms>]" (with
+   * the rate it saw, for mon_rate), whether ours or from the node that
+   * triggered; carried in "exit" and trigger datagrams.  "" = unknown. */
+  char trigger_reason[96];
+  struct peer_s *stop_peer;  /* Peer whose stop time we adopted (NULL = ours). */
+  cap_stats_t cap;       /* In-process capture (cap_iface) counters. */
+  cap_stats_t *cap_threads;  /* The same, per capture thread. */
+} stats_t;
 
 /* Config globals. */
 struct in_addr cfg_init_ip;
 int cfg_init_port = 0;
 int cfg_listen_port = 0;
-char *cfg_mon_file = NULL;
+int cfg_listen_peers = 1;
+int cfg_ping_interval_ms = 1000;
+int cfg_peer_timeout_ms = 5000;  /* 0 = no heartbeats. */
+struct in_addr cfg_mcast_group;
+int cfg_mcast_port = 0;
+struct in_addr cfg_mcast_if;  /* Interface address; INADDR_ANY by default. */
+int cfg_mcast_ttl = 1;
+cfg_mon_spec_t *cfg_mon_specs = NULL;
+int cfg_num_mon_specs = 0;
+mpat_t *cfg_mon_patterns = NULL;  /* Default: mon_pattern(s) before any mon_file. */
 char *cfg_cap_cmd = NULL;
+char *cfg_cap_iface = NULL;
+char *cfg_cap_file = NULL;
+int cfg_cap_pre_mb = 0;
+int cfg_cap_pre_ms = 0;
+int cfg_cap_threads = 1;
+int cfg_cap_fanout_cpu = 0;
+int *cfg_cap_cpus = NULL;  /* cfg_cap_threads entries, or NULL. */
+bpf_prog_t *cfg_cap_filter = NULL;
+int cfg_num_cap_cpus = 0;
+int cfg_cap_direct = 0;
+int cfg_cap_compress = 0;
 int cfg_cap_linger_ms = 0;
-char *cfg_mon_pat_str = NULL;  /* Regular expression compiled pattern. */
-re_t *cfg_mon_pattern = NULL;  /* Regular expression compiled pattern. */
+int cfg_mon_engine = RE_ENGINE_AUTO;
+int cfg_mon_workers = 0;  /* 0 = match in the reading thread. */
+int *cfg_mon_worker_cpus = NULL;  /* cfg_mon_workers entries, or NULL. */
+int cfg_num_mon_worker_cpus = 0;
+int cfg_event_loop = 1;
+char *cfg_stats_file = NULL;
+int cfg_rearm = 0;
+int cfg_rearm_max = 0;  /* 0 = no limit. */
 
 /* Initialized by main, used by threads. */
-plat_sock_t peer_sock;
-FILE *mon_fp;
+peer_t *peers = NULL;
+int num_peers = 0;
+plat_sock_t listen_sock = PLAT_INVALID_SOCK;  /* Listener: kept for reconnects. */
+plat_evl_t *evl = NULL;  /* Event loop (NULL: threaded backend). */
+/* When the captures stop, in our wall clock (0 = not decided yet).  Set
+ * by whichever node triggers and carried to the others in "exit". */
+uint64_t stop_wall_ns = 0;
+/* Triggers handled so far; the current one is trigger_num + 1.  Carried
+ * in "exit" and trigger datagrams so that all nodes number them alike. */
+int trigger_num = 0;
+
+/* Multicast mode (instead of peers). */
+plat_sock_t mcast_sock = PLAT_INVALID_SOCK;
+char mcast_origin[96];   /* Our id in trigger datagrams: host/random. */
+uint64_t mcast_recv_ns = 0;  /* When another node's trigger arrived (0 = none). */
+mon_file_t *mon_files = NULL;
+int num_mon_files = 0;
+plat_mon_t *mon_watch;
+char *mon_buf;  /* Read buffer shared by all files (only one thread reads). */
+char *mon_changed;  /* Per file: set by plat_mon_wait. */
+mon_scanner_t mon_scanner;  /* Its pool is the mon_workers (NULL if none). */
 
 /* Capture subprocess. */
 plat_proc_t cap_proc;
 int cap_running = 0;
+/* In-process capture (instead of the subprocess). */
+cap_t *cap = NULL;
 
 volatile int exiting = 0;
+stats_t stats;
+
+
+/* Note the patterns that use a matcher generated by re_gen. */
+void cfg_gen_info(mpat_t *pats) {
+  int i;
+
+  for (i = 0; i < pats->num_pats; i++) {
+    if (pats->pats[i] != NULL && pats->pats[i]->gen != NULL) {
+      fprintf(stderr, "INFO: mon_pattern '%s' uses a generated matcher\n", pats->pat_strs[i]);
+    }
+  }
+}  /* cfg_gen_info */
 
 
 void cfg_parse(char *cfg_file_name) {
@@ -49,9 +199,12 @@ void cfg_parse(char *cfg_file_name) {
   int has_init_ip = 0;
   int has_init_port = 0;
   int has_listen_port = 0;
-  int rc;
+  int has_mcast_group = 0;
+  int rc, i;
   FILE *fp;
 
+  cfg_mcast_if.s_addr = htonl(INADDR_ANY);
+
   fp = fopen(cfg_file_name, "r");  E(fp == NULL);
 
   while (fgets(line, sizeof(line), fp) != NULL) {
@@ -75,15 +228,141 @@ void cfg_parse(char *cfg_file_name) {
     } else if (strcmp(key, "listen_port") == 0) {
       cfg_listen_port = atoi(val_str);  E(cfg_listen_port <= 0);
       has_listen_port = 1;
+    } else if (strcmp(key, "mcast_group") == 0) {
+      rc = inet_pton(AF_INET, val_str, &cfg_mcast_group);  E(rc != 1);
+      has_mcast_group = 1;
+    } else if (strcmp(key, "mcast_port") == 0) {
+      cfg_mcast_port = atoi(val_str);  E(cfg_mcast_port <= 0);
+    } else if (strcmp(key, "mcast_if") == 0) {
+      rc = inet_pton(AF_INET, val_str, &cfg_mcast_if);  E(rc != 1);
+    } else if (strcmp(key, "mcast_ttl") == 0) {
+      cfg_mcast_ttl = atoi(val_str);  E(cfg_mcast_ttl <= 0);
+    } else if (strcmp(key, "listen_peers") == 0) {
+      cfg_listen_peers = atoi(val_str);  E(cfg_listen_peers <= 0);
     } else if (strcmp(key, "mon_file") == 0) {
-      cfg_mon_file = strdup(val_str);  E(cfg_mon_file == NULL);
+      /* Repeatable; may be a wildcard pattern. */
+      cfg_mon_specs = (cfg_mon_spec_t *)realloc(cfg_mon_specs,
+          (cfg_num_mon_specs + 1) * sizeof(cfg_mon_spec_t));  E(cfg_mon_specs == NULL);
+      cfg_mon_specs[cfg_num_mon_specs].path = strdup(val_str);  E(cfg_mon_specs[cfg_num_mon_specs].path == NULL);
+      cfg_mon_specs[cfg_num_mon_specs].patterns = NULL;
+      cfg_num_mon_specs++;
     } else if (strcmp(key, "cap_cmd") == 0) {
       cfg_cap_cmd = strdup(val_str);  E(cfg_cap_cmd == NULL);
+    } else if (strcmp(key, "cap_iface") == 0) {
+      cfg_cap_iface = strdup(val_str);  E(cfg_cap_iface == NULL);
+    } else if (strcmp(key, "cap_file") == 0) {
+      cfg_cap_file = strdup(val_str);  E(cfg_cap_file == NULL);
+    } else if (strcmp(key, "cap_pre_mb") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_cap_pre_mb);  E(rc != 1);
+      E(cfg_cap_pre_mb < 0);
+    } else if (strcmp(key, "cap_pre_ms") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_cap_pre_ms);  E(rc != 1);
+      E(cfg_cap_pre_ms < 0);
+    } else if (strcmp(key, "cap_threads") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_cap_threads);  E(rc != 1);
+      E(cfg_cap_threads < 1);
+    } else if (strcmp(key, "cap_fanout") == 0) {
+      if (strcmp(val_str, "hash") == 0) { cfg_cap_fanout_cpu = 0; }
+      else if (strcmp(val_str, "cpu") == 0) { cfg_cap_fanout_cpu = 1; }
+      else {
+        fprintf(stderr, "ERROR: unknown cap_fanout '%s'\n", val_str);
+        exit(1);
+      }
+    } else if (strcmp(key, "cap_cpus") == 0) {
+      /* Comma-separated, one per capture thread. */
+      char *tok = strtok(val_str, ",");
+      while (tok != NULL) {
+        cfg_cap_cpus = (int *)realloc(cfg_cap_cpus, (cfg_num_cap_cpus + 1) * sizeof(int));  E(cfg_cap_cpus == NULL);
+        rc = sscanf(tok, "%d", &cfg_cap_cpus[cfg_num_cap_cpus]);  E(rc != 1);
+        E(cfg_cap_cpus[cfg_num_cap_cpus] < 0);
+        cfg_num_cap_cpus++;
+        tok = strtok(NULL, ",");
+      }
+    } else if (strcmp(key, "cap_filter") == 0) {
+      char err[256];
+      if (cfg_cap_filter != NULL) { bpf_free(cfg_cap_filter); }
+      cfg_cap_filter = bpf_compile(val_str, CAP_SNAPLEN, err, sizeof(err));
+      if (cfg_cap_filter == NULL) {
+        fprintf(stderr, "ERROR: cap_filter: %s\n", err);
+        exit(1);
+      }
+    } else if (strcmp(key, "cap_direct") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_cap_direct);  E(rc != 1);
+      E(cfg_cap_direct != 0 && cfg_cap_direct != 1);
+    } else if (strcmp(key, "cap_compress") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_cap_compress);  E(rc != 1);
+      E(cfg_cap_compress < 0 || cfg_cap_compress > 9);
+      if (cfg_cap_compress > 0 && !capwr_can_compress()) {
+        fprintf(stderr, "ERROR: cap_compress: built without zlib\n");
+        exit(1);
+      }
     } else if (strcmp(key, "cap_linger_ms") == 0) {
       cfg_cap_linger_ms = atoi(val_str);  E(cfg_cap_linger_ms < 0);
-    } else if (strcmp(key, "mon_pattern") == 0) {
-      cfg_mon_pat_str = strdup(val_str);  E(cfg_mon_pat_str == NULL);
-      cfg_mon_pattern = re_compile(cfg_mon_pat_str);  E(cfg_mon_pattern == NULL);
+    } else if (strcmp(key, "mon_pattern") == 0 || strcmp(key, "mon_field") == 0) {
+      /* Repeatable; a line matching any of them triggers.  Applies to the
+       * preceding mon_file, or to all files if before the first one. */
+      mpat_t **pats = (cfg_num_mon_specs > 0) ?
+          &cfg_mon_specs[cfg_num_mon_specs - 1].patterns : &cfg_mon_patterns;
+      if (*pats == NULL) {
+        *pats = mpat_create();
+      }
+      if (strcmp(key, "mon_pattern") == 0) {
+        mpat_add(*pats, val_str);
+      } else {
+        char err[256];
+        if (mpat_add_field(*pats, val_str, err, sizeof(err)) < 0) {
+          fprintf(stderr, "ERROR: mon_field: %s\n", err);
+          exit(1);
+        }
+      }
+    } else if (strcmp(key, "mon_rate") == 0) {
+      /* count/window_ms, for the preceding mon_pattern or mon_field. */
+      mpat_t *pats = (cfg_num_mon_specs > 0) ?
+          cfg_mon_specs[cfg_num_mon_specs - 1].patterns : cfg_mon_patterns;
+      int count, window_ms;
+      E(pats == NULL);
+      E(pats->pat_data[pats->num_pats - 1] != NULL);
+      rc = sscanf(val_str, "%d/%d", &count, &window_ms);  E(rc != 2);
+      E(count < 1 || window_ms < 1);
+      mon_rate_set(pats, pats->num_pats - 1, count, window_ms);
+    } else if (strcmp(key, "rearm") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_rearm);  E(rc != 1);
+      E(cfg_rearm != 0 && cfg_rearm != 1);
+    } else if (strcmp(key, "rearm_max") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_rearm_max);  E(rc != 1);
+      E(cfg_rearm_max < 0);
+    } else if (strcmp(key, "stats_file") == 0) {
+      cfg_stats_file = strdup(val_str);  E(cfg_stats_file == NULL);
+    } else if (strcmp(key, "peer_timeout_ms") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_peer_timeout_ms);  E(rc != 1);
+      E(cfg_peer_timeout_ms < 0);
+    } else if (strcmp(key, "ping_interval_ms") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_ping_interval_ms);  E(rc != 1);
+      E(cfg_ping_interval_ms < 0);
+    } else if (strcmp(key, "event_loop") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_event_loop);  E(rc != 1);
+      E(cfg_event_loop != 0 && cfg_event_loop != 1);
+    } else if (strcmp(key, "mon_engine") == 0) {
+      if (strcmp(val_str, "auto") == 0) { cfg_mon_engine = RE_ENGINE_AUTO; }
+      else if (strcmp(val_str, "backtrack") == 0) { cfg_mon_engine = RE_ENGINE_BACKTRACK; }
+      else if (strcmp(val_str, "pikevm") == 0) { cfg_mon_engine = RE_ENGINE_PIKEVM; }
+      else {
+        fprintf(stderr, "ERROR: unknown mon_engine '%s'\n", val_str);
+        exit(1);
+      }
+    } else if (strcmp(key, "mon_workers") == 0) {
+      rc = sscanf(val_str, "%d", &cfg_mon_workers);  E(rc != 1);
+      E(cfg_mon_workers < 0);
+    } else if (strcmp(key, "mon_worker_cpus") == 0) {
+      /* Comma-separated, one per worker. */
+      char *tok = strtok(val_str, ",");
+      while (tok != NULL) {
+        cfg_mon_worker_cpus = (int *)realloc(cfg_mon_worker_cpus, (cfg_num_mon_worker_cpus + 1) * sizeof(int));  E(cfg_mon_worker_cpus == NULL);
+        rc = sscanf(tok, "%d", &cfg_mon_worker_cpus[cfg_num_mon_worker_cpus]);  E(rc != 1);
+        E(cfg_mon_worker_cpus[cfg_num_mon_worker_cpus] < 0);
+        cfg_num_mon_worker_cpus++;
+        tok = strtok(NULL, ",");
+      }
     } else {
       fprintf(stderr, "ERROR: unknown key '%s'\n", key);
       exit(1);
@@ -92,152 +371,1380 @@ void cfg_parse(char *cfg_file_name) {
 
   fclose(fp);
 
-  /* Exactly one of init_ip or listen_port must be supplied. */
-  E(has_init_ip == has_listen_port);
+  if (cfg_mon_patterns != NULL) {
+    mpat_set_engine(cfg_mon_patterns, cfg_mon_engine);
+    mpat_build(cfg_mon_patterns);
+    cfg_gen_info(cfg_mon_patterns);
+  }
+  for (i = 0; i < cfg_num_mon_specs; i++) {
+    if (cfg_mon_specs[i].patterns != NULL) {
+      mpat_set_engine(cfg_mon_specs[i].patterns, cfg_mon_engine);
+      mpat_build(cfg_mon_specs[i].patterns);
+      cfg_gen_info(cfg_mon_specs[i].patterns);
+    }
+  }
+
+  /* Exactly one of init_ip, listen_port or mcast_group must be supplied. */
+  E(has_init_ip + has_listen_port + has_mcast_group != 1);
+  /* mcast_port required iff mcast_group. */
+  E((cfg_mcast_port > 0) != has_mcast_group);
   /* init_port required iff init_ip. */
   E(has_init_port != has_init_ip);
   /* mon_file required. */
-  E(cfg_mon_file == NULL);
+  E(cfg_num_mon_specs == 0);
+  /* cap_file required iff cap_iface, which excludes cap_cmd. */
+  E((cfg_cap_file != NULL) != (cfg_cap_iface != NULL));
+  E(cfg_cap_iface != NULL && cfg_cap_cmd != NULL);
+  /* The flight recorder is part of the in-process capture. */
+  E((cfg_cap_pre_mb > 0 || cfg_cap_pre_ms > 0) && cfg_cap_iface == NULL);
+  E(cfg_cap_pre_ms > 0 && cfg_cap_pre_mb == 0);
+  E(cfg_cap_threads > 1 && cfg_cap_iface == NULL);
+  E(cfg_cap_filter != NULL && cfg_cap_iface == NULL);
+  E((cfg_cap_direct || cfg_cap_compress > 0) && cfg_cap_iface == NULL);
+  /* cap_cpus, if given, has one CPU per capture thread. */
+  E(cfg_cap_cpus != NULL && cfg_num_cap_cpus != cfg_cap_threads);
+  /* mon_worker_cpus, if given, has one CPU per worker. */
+  E(cfg_mon_worker_cpus != NULL && cfg_num_mon_worker_cpus != cfg_mon_workers);
+  /* Rearm: each trigger's capture needs its own file. */
+  E(cfg_rearm_max > 0 && !cfg_rearm);
+  E(cfg_rearm && cfg_cap_file != NULL && strstr(cfg_cap_file, "%n") == NULL);
+  E(cfg_rearm && cfg_cap_cmd != NULL && strstr(cfg_cap_cmd, "%n") == NULL);
 }  /* cfg_parse */
 
 
-plat_sock_t peer_connect(void) {
-  plat_sock_t sock, peer;
+/* Copy of s with each "%n" replaced by the trigger number n (malloced). */
+char *cfg_subst_n(const char *s, int n) {
+  char num[16];
+  const char *p;
+  char *out, *o;
+  size_t num_len, count = 0;
+
+  num_len = (size_t)snprintf(num, sizeof(num), "%d", n);
+  for (p = strstr(s, "%n"); p != NULL; p = strstr(p + 2, "%n")) { count++; }
+  out = (char *)malloc(strlen(s) + count * num_len + 1);  E(out == NULL);
+  for (o = out; *s != '\0'; ) {
+    if (s[0] == '%' && s[1] == 'n') {
+      memcpy(o, num, num_len);
+      o += num_len;
+      s += 2;
+    } else {
+      *o++ = *s++;
+    }
+  }
+  *o = '\0';
+  return out;
+}  /* cfg_subst_n */
+
+
+int peer_up(const peer_t *peer) {
+  return peer->sock != PLAT_INVALID_SOCK && !peer->connecting;
+}  /* peer_up */
+
+
+/* Peers that haven't said "bye" (connected, or expected to reconnect). */
+int peer_count(void) {
+  int num_left = 0;
+  int i;
+
+  for (i = 0; i < num_peers; i++) {
+    if (!peers[i].gone) { num_left++; }
+  }
+  return num_left;
+}  /* peer_count */
+
+
+peer_t *peer_new(void) {
+  peer_t *peer;
+
+  peers = (peer_t *)realloc(peers, (num_peers + 1) * sizeof(peer_t));  E(peers == NULL);
+  peer = &peers[num_peers++];
+  memset(peer, 0, sizeof(*peer));
+  peer->sock = PLAT_INVALID_SOCK;
+  return peer;
+}  /* peer_new */
+
+
+/* The peer's connection is up on sock. */
+void peer_set_sock(peer_t *peer, plat_sock_t sock) {
   struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  char ip[INET_ADDRSTRLEN] = "?";
   int opt = 1;
-  int rc;
 
-  sock = socket(AF_INET, SOCK_STREAM, 0);  E(sock == PLAT_INVALID_SOCK);
+  peer->sock = sock;
+  peer->connecting = 0;
+  peer->rlen = 0;
+  peer->last_recv_ns = peer->last_hb_ns = plat_monotonic_ns();
+  peer->next_ping_ns = 0;
+  peer->attempts = 0;
+  peer->backoff_ms = RECONNECT_MIN_MS;
+  peer->connects++;
+  /* Pings and triggers are tiny; don't let Nagle hold them back. */
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&opt, sizeof(opt));
 
   memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
+  if (getpeername(sock, (struct sockaddr *)&addr, &addr_len) == 0) {
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  }
+  snprintf(peer->name, sizeof(peer->name), "%s:%d", ip, (int)ntohs(addr.sin_port));
+  if (peer->connects > 1) {
+    fprintf(stderr, "INFO: peer %s: reconnected\n", peer->name);
+  }
+  if (evl != NULL) { E(plat_evl_add_sock(evl, sock, (int)(peer - peers)) != 0); }
+}  /* peer_set_sock */
 
-  if (cfg_init_port > 0) {
-    /* Initiator: connect to listener. */
+
+void peer_close(peer_t *peer) {
+  if (peer->sock == PLAT_INVALID_SOCK) { return; }
+  if (evl != NULL && !peer->connecting) { plat_evl_del_sock(evl, peer->sock); }
+  plat_close_sock(peer->sock);
+  peer->sock = PLAT_INVALID_SOCK;
+  peer->connecting = 0;
+}  /* peer_close */
+
+
+/* The connection failed (closed, or heartbeat timeout).  That is not a
+ * trigger: the initiator reconnects, the listener waits for it to. */
+void peer_down(peer_t *peer, const char *why) {
+  fprintf(stderr, "INFO: peer %s: connection lost (%s)\n", peer->name, why);
+  peer_close(peer);
+  peer->retry_ns = plat_monotonic_ns();
+  peer->backoff_ms = RECONNECT_MIN_MS;
+}  /* peer_down */
+
+
+/* Initiator: move a down peer's reconnect along (never waits).  Returns
+ * ms until it should be called again. */
+int peer_reconnect(peer_t *peer) {
+  uint64_t now_ns = plat_monotonic_ns();
+  struct sockaddr_in addr;
+  plat_sock_t sock;
+  int rc;
+
+  if (!peer->connecting) {
+    if (now_ns < peer->retry_ns) {
+      return (int)((peer->retry_ns - now_ns + 999999) / 1000000);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
     addr.sin_addr = cfg_init_ip;
     addr.sin_port = htons((uint16_t)cfg_init_port);
-    rc = connect(sock, (struct sockaddr *)&addr, sizeof(addr));  E(rc != 0);
-    peer = sock;
+    sock = socket(AF_INET, SOCK_STREAM, 0);  E(sock == PLAT_INVALID_SOCK);
+    rc = plat_connect_start(sock, (struct sockaddr *)&addr, sizeof(addr));
+    peer->sock = sock;
+    peer->connecting = 1;
+    peer->connect_ns = now_ns;
   } else {
-    /* Listener: accept one connection. */
+    rc = plat_connect_check(peer->sock);
+    if (rc == 1 && now_ns - peer->connect_ns > 1000000ULL * CONNECT_TIMEOUT_MS) { rc = -1; }
+  }
+
+  if (rc == 0) {
+    peer_set_sock(peer, peer->sock);
+    return -1;
+  }
+  if (rc == 1) { return CONNECT_POLL_MS; }
+
+  /* Failed: try again later, backing off. */
+  if (peer->attempts++ == 0) {
+    fprintf(stderr, "INFO: connect to %s:%d failed; retrying\n",
+        inet_ntoa(cfg_init_ip), cfg_init_port);
+  }
+  peer_close(peer);
+  peer->retry_ns = now_ns + 1000000ULL * peer->backoff_ms;
+  rc = peer->backoff_ms;
+  peer->backoff_ms *= 2;
+  if (peer->backoff_ms > RECONNECT_MAX_MS) { peer->backoff_ms = RECONNECT_MAX_MS; }
+  return rc;
+}  /* peer_reconnect */
+
+
+/* Listener: accept a connection in place of one that was lost. */
+void peer_accept(void) {
+  plat_sock_t sock;
+  int i;
+
+  sock = accept(listen_sock, NULL, NULL);
+  if (sock == PLAT_INVALID_SOCK) { return; }
+  for (i = 0; i < num_peers; i++) {
+    if (peers[i].sock == PLAT_INVALID_SOCK && !peers[i].gone) {
+      peer_set_sock(&peers[i], sock);
+      return;
+    }
+  }
+  fprintf(stderr, "INFO: rejected connection (all %d peers connected)\n", num_peers);
+  plat_close_sock(sock);
+}  /* peer_accept */
+
+
+void peer_connect(void) {
+  struct sockaddr_in addr;
+  peer_t *peer;
+  int opt = 1;
+  int rc, i, wait_ms;
+
+  if (cfg_init_port > 0) {
+    /* Initiator: connect to listener, retrying until it is there. */
+    peer = peer_new();
+    while (!peer_up(peer)) {
+      wait_ms = peer_reconnect(peer);
+      if (wait_ms > 0) { plat_sleep_ms(wait_ms); }
+    }
+  } else {
+    /* Listener: accept listen_peers connections.  With more than one,
+     * this instance is the hub that fans triggers out to the others.
+     * The listen socket stays open for peers that reconnect. */
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);  E(listen_sock == PLAT_INVALID_SOCK);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons((uint16_t)cfg_listen_port);
-    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
-    rc = bind(sock, (struct sockaddr *)&addr, sizeof(addr));  E(rc != 0);
-    rc = listen(sock, 1);  E(rc != 0);
-    peer = accept(sock, NULL, NULL);  E(peer == PLAT_INVALID_SOCK);
-    plat_close_sock(sock);  /* Done with listen socket. */
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+    rc = bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr));  E(rc != 0);
+    rc = listen(listen_sock, cfg_listen_peers);  E(rc != 0);
+    for (i = 0; i < cfg_listen_peers; i++) {
+      peer_new();
+    }
+    while (!peer_up(&peers[cfg_listen_peers - 1])) {
+      peer_accept();  /* Fills the peers in order. */
+    }
   }
-
-  return peer;
 }  /* peer_connect */
 
 
-FILE *mon_open(void) {
-  FILE *fp;
+/* Multicast mode: join the group.  There is no connection; every node
+ * that has joined sees every trigger. */
+void mcast_open(void) {
+  struct sockaddr_in addr;
+  struct ip_mreq mreq;
+  char host[64];
+  int opt = 1;
+  int rc;
+
+  mcast_sock = socket(AF_INET, SOCK_DGRAM, 0);  E(mcast_sock == PLAT_INVALID_SOCK);
+  /* Several instances on one host may share the port. */
+  setsockopt(mcast_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons((uint16_t)cfg_mcast_port);
+  rc = bind(mcast_sock, (struct sockaddr *)&addr, sizeof(addr));  E(rc != 0);
+
+  mreq.imr_multiaddr = cfg_mcast_group;
+  mreq.imr_interface = cfg_mcast_if;
+  rc = setsockopt(mcast_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq));  E(rc != 0);
+  rc = setsockopt(mcast_sock, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&cfg_mcast_if, sizeof(cfg_mcast_if));  E(rc != 0);
+  rc = setsockopt(mcast_sock, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&cfg_mcast_ttl, sizeof(cfg_mcast_ttl));  E(rc != 0);
+  /* Other instances on this host must see our triggers too. */
+  rc = setsockopt(mcast_sock, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&opt, sizeof(opt));  E(rc != 0);
+
+  if (gethostname(host, sizeof(host)) != 0) { strcpy(host, "?"); }
+  host[sizeof(host) - 1] = '\0';
+  snprintf(mcast_origin, sizeof(mcast_origin), "%s/%08x", host,
+      (unsigned)(plat_monotonic_ns() ^ (uintptr_t)&host));
+}  /* mcast_open */
+
+
+/* Adopt the reason another node gave for its trigger, unless we have
+ * one.  Returns 1 if adopted. */
+int peer_trigger_reason(const char *reason) {
+  if (reason[0] == '\0' || stats.trigger_reason[0] != '\0' || stats.matched_ns != 0) {
+    return 0;
+  }
+  snprintf(stats.trigger_reason, sizeof(stats.trigger_reason), "%s", reason);
+  return 1;
+}  /* peer_trigger_reason */
+
+
+/* Read one datagram.  Returns 1 if it was another node's trigger. */
+int mcast_recv(void) {
+  char buf[256];
+  char origin[96];
+  char *reason;
+  unsigned seq;
+  int len, end = 0;
+
+  len = recv(mcast_sock, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) { return 0; }
+  buf[len] = '\0';
+
+  if (sscanf(buf, "dual_cap trigger %u %95s%n", &seq, origin, &end) != 2) { return 0; }
+  if (strcmp(origin, mcast_origin) == 0) { return 0; }  /* Our own, looped back. */
+  if ((int)seq <= trigger_num) { return 0; }  /* Repeat of one already handled. */
+  /* Optional reason: the rest of the line. */
+  reason = buf + end;
+  reason += strspn(reason, " ");
+  reason[strcspn(reason, "\r\n")] = '\0';
+
+  if (mcast_recv_ns == 0) {
+    mcast_recv_ns = plat_monotonic_ns();
+    peer_trigger_reason(reason);
+    fprintf(stderr, "INFO: trigger %u from %s via multicast%s%s\n", seq, origin,
+        (reason[0] != '\0') ? ": " : "", reason);
+  }
+  return 1;
+}  /* mcast_recv */
+
+
+/* Threaded backend: wait up to timeout_ms for a trigger datagram.
+ * Returns 1 if another node triggered. */
+int mcast_poll(int timeout_ms) {
+  fd_set rfds;
+  struct timeval tv;
+
+  FD_ZERO(&rfds);
+  FD_SET(mcast_sock, &rfds);
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  if (select((int)(mcast_sock + 1), &rfds, NULL, NULL, &tv) <= 0) { return 0; }
+  return mcast_recv();
+}  /* mcast_poll */
 
-  fp = fopen(cfg_mon_file, "r");  E(fp == NULL);
+
+/* If the trigger was ours, tell the group (one send reaches all). */
+void mcast_trigger(void) {
+  struct sockaddr_in addr;
+  char msg[256];
+  int len, i;
+
+  if (mcast_recv_ns == 0) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = cfg_mcast_group;
+    addr.sin_port = htons((uint16_t)cfg_mcast_port);
+    len = snprintf(msg, sizeof(msg), "dual_cap trigger %d %s %s\n", trigger_num + 1, mcast_origin,
+        stats.trigger_reason);
+    stats.sent_ns = plat_monotonic_ns();
+    for (i = 0; i < MCAST_REPEAT; i++) {
+      if (i > 0) { plat_sleep_ms(1); }
+      sendto(mcast_sock, msg, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+    }
+  }
+}  /* mcast_trigger */
+
+
+/* Note why pattern pat_idx of mf triggered, for the peers (see
+ * stats.trigger_reason). */
+void mon_trigger_reason(mon_file_t *mf, int pat_idx) {
+  mon_rate_t *rate;
+  int len;
+
+  stats.trigger_reason[0] = '\0';
+  if (pat_idx < 0) { return; }  /* Any line. */
+  len = snprintf(stats.trigger_reason, sizeof(stats.trigger_reason), "%s %d",
+      mon_pat_kind(mf->patterns, pat_idx), pat_idx + 1);
+  rate = (mon_rate_t *)mf->patterns->pat_data[pat_idx];
+  if (rate != NULL) {
+    snprintf(stats.trigger_reason + len, sizeof(stats.trigger_reason) - len, " %d/%d %d %.1f",
+        rate->count, rate->window_ms, rate->fired_total, (double)rate->fired_span_ns / 1000000.0);
+  }
+}  /* mon_trigger_reason */
+
+
+/* A log line matched: record when, and start shutting down. */
+void mon_trigger(mon_file_t *mf, int pat_idx) {
+  if (!exiting) {
+    stats.matched_ns = plat_monotonic_ns();
+    stats.observed_ns = mon_scanner.observed_ns;
+    stats.trigger_file = mf;
+    stats.trigger_pat = pat_idx;
+    mon_trigger_reason(mf, pat_idx);
+  }
+  exiting = 1;
+}  /* mon_trigger */
+
+
+/* plat_glob callback: open one log file and start watching it. */
+void mon_open_file(const char *path, void *arg) {
+  cfg_mon_spec_t *spec = (cfg_mon_spec_t *)arg;
+  mon_file_t *mf;
+  int id;
+
+  mon_files = (mon_file_t *)realloc(mon_files,
+      (num_mon_files + 1) * sizeof(mon_file_t));  E(mon_files == NULL);
+  mf = &mon_files[num_mon_files];
+  memset(mf, 0, sizeof(*mf));
+  mf->path = strdup(path);  E(mf->path == NULL);
+  mf->patterns = (spec->patterns != NULL) ? spec->patterns : cfg_mon_patterns;
+
+  mf->fp = fopen(path, "r");  E(mf->fp == NULL);
+  /* The monitor reads big blocks into its own buffer; bypass stdio's. */
+  E(setvbuf(mf->fp, NULL, _IONBF, 0) != 0);
+
+  /* Watch before seeking so that no write after the seek goes unnoticed. */
+  id = plat_mon_add(mon_watch, path);  E(id != num_mon_files);
 
   /* Skip past current content. */
-  E(fseek(fp, 0, SEEK_END) != 0);
+  E(fseek(mf->fp, 0, SEEK_END) != 0);
+
+  num_mon_files++;
+}  /* mon_open_file */
+
+
+void mon_open(void) {
+  int i;
 
-  return fp;
+  mon_watch = plat_mon_create();  E(mon_watch == NULL);
+  for (i = 0; i < cfg_num_mon_specs; i++) {
+    E(plat_glob(cfg_mon_specs[i].path, mon_open_file, &cfg_mon_specs[i]) <= 0);
+  }
+
+  mon_scanner.stop = &exiting;
+  mon_scanner.trigger = mon_trigger;
+  mon_buf = (char *)malloc(MON_BUF_SIZE);  E(mon_buf == NULL);
+  mon_changed = (char *)malloc(num_mon_files);  E(mon_changed == NULL);
 }  /* mon_open */
 
 
-void *file_mon_thread(void *arg) {
-  char line[2048];
-  (void)arg;
+/* Read and scan everything appended to a file since the last call.
+ * rescan: first scan what is left over from then (after a trigger, the
+ * lines that followed it). */
+void mon_read(mon_file_t *mf, int rescan) {
+  size_t buf_len, got, used;
+  uint64_t cpu_ns;
+
+  /* Resume the incomplete line left over from last time. */
+  memcpy(mon_buf, mf->carry, mf->carry_len);
+  buf_len = mf->carry_len;
 
   while (!exiting) {
-    if (fgets(line, sizeof(line), mon_fp) != NULL) {
-      /* Strip trailing cr/nl for pattern matching. */
-      size_t line_len = strlen(line);
-      while (line_len > 0 && (line[line_len - 1] == '\n' || line [line_len - 1] == '\r')) {
-        line_len --;
-        line[line_len] = '\0';
-      }
-      if (cfg_mon_pattern == NULL || re_match(cfg_mon_pattern, line, NULL, NULL)) {
-        exiting = 1;
-      }
+    if (rescan) {
+      rescan = 0;
+      mon_scanner.observed_ns = plat_monotonic_ns();
     } else {
-      clearerr(mon_fp);
-      fseek(mon_fp, 0, SEEK_CUR);  /* Force runtime to recheck file size (Windows). */
-      plat_sleep_ms(100);
+      got = fread(mon_buf + buf_len, 1, MON_BUF_SIZE - buf_len, mf->fp);
+      if (got == 0) {
+        clearerr(mf->fp);
+        fseek(mf->fp, 0, SEEK_CUR);  /* Force runtime to recheck file size (Windows). */
+        break;
+      }
+      mon_scanner.observed_ns = plat_monotonic_ns();
+      mf->bytes += got;
+      buf_len += got;
+    }
+    cpu_ns = plat_thread_cpu_ns();
+    used = mon_scan(&mon_scanner, mf, mon_buf, buf_len);
+    stats.scan_cpu_ns += plat_thread_cpu_ns() - cpu_ns;
+    buf_len -= used;
+    if (buf_len > 0 && used > 0) {
+      memmove(mon_buf, mon_buf + used, buf_len);
+    }
+  }
+
+  if (buf_len > mf->carry_size) {
+    mf->carry_size = buf_len;
+    mf->carry = (char *)realloc(mf->carry, mf->carry_size);  E(mf->carry == NULL);
+  }
+  memcpy(mf->carry, mon_buf, buf_len);
+  mf->carry_len = buf_len;
+}  /* mon_read */
+
+
+/* Wait up to timeout_ms for log files to change and scan the new lines. */
+void mon_check(int timeout_ms) {
+  int i;
+
+  if (plat_mon_wait(mon_watch, timeout_ms, mon_changed) > 0) {
+    for (i = 0; i < num_mon_files && !exiting; i++) {
+      if (mon_changed[i]) {
+        mon_read(&mon_files[i], 0);
+      }
     }
   }
+}  /* mon_check */
+
+
+/* Rearm: carry on from where each file was left (a trigger stops the
+ * scan, and its file's change events may not all have been seen), so
+ * lines logged since then can trigger again. */
+void mon_rearm(void) {
+  int i;
+
+  for (i = 0; i < num_mon_files; i++) {
+    mon_files[i].bytes = 0;
+    mon_files[i].lines = 0;
+    mon_files[i].long_lines = 0;
+  }
+  if (mon_scanner.pool != NULL) { mwork_reset_stats(mon_scanner.pool); }
+  for (i = 0; i < num_mon_files && !exiting; i++) {
+    mon_read(&mon_files[i], 1);
+  }
+}  /* mon_rearm */
+
+
+void mon_close(void) {
+  int i;
+
+  for (i = 0; i < num_mon_files; i++) {
+    fclose(mon_files[i].fp);
+  }
+  plat_mon_close(mon_watch);
+  if (mon_scanner.pool != NULL) { mwork_close(mon_scanner.pool); }
+  free(mon_changed);
+  free(mon_buf);
+}  /* mon_close */
+
+
+void *file_mon_thread(void *arg) {
+  (void)arg;
+
+  while (!exiting) {
+    /* Sleep until a file changes (or 100 ms, to notice exiting). */
+    mon_check(100);
+  }
 
-  fclose(mon_fp);
   return NULL;
 }  /* file_mon_thread */
 
 
-void *peer_comm_thread(void *arg) {
+/* Best current estimate of a peer's clock: of the recent samples, the
+ * one with the shortest round trip, as its offset has the smallest error
+ * (at most rtt / 2).  Returns 0 if there are no samples yet. */
+int peer_clock(peer_t *peer, int64_t *offset_ns, uint64_t *rtt_ns) {
+  int n = (peer->num_pings < PING_SAMPLES) ? peer->num_pings : PING_SAMPLES;
+  int best = -1;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    if (best == -1 || peer->ping_rtt[i] < peer->ping_rtt[best]) { best = i; }
+  }
+  if (best == -1) { return 0; }
+  *offset_ns = peer->ping_offset[best];
+  *rtt_ns = peer->ping_rtt[best];
+  return 1;
+}  /* peer_clock */
+
+
+/* Send the pings and heartbeats that are due, notice peers that have
+ * gone quiet for peer_timeout_ms, and move reconnects along.  Returns ms
+ * until something is next due, or -1 if nothing is. */
+int peer_timers(void) {
+  uint64_t now_ns = plat_monotonic_ns();
+  uint64_t hb_ns = 250000ULL * cfg_peer_timeout_ms;  /* A quarter of the timeout. */
+  uint64_t next_ns = 0;
+  char msg[64];
+  int len, i, wait_ms;
+  int next_ms = -1;
+
+#define DUE(t_) do { if (next_ns == 0 || (t_) < next_ns) { next_ns = (t_); } } while (0)
+  for (i = 0; i < num_peers; i++) {
+    peer_t *peer = &peers[i];
+    if (peer->gone) { continue; }
+    if (!peer_up(peer)) {
+      if (cfg_init_port > 0) {
+        /* -1: it just connected; its timers start from the next call. */
+        wait_ms = peer_reconnect(peer);
+        if (wait_ms < 0) { wait_ms = 0; }
+        if (next_ms < 0 || wait_ms < next_ms) { next_ms = wait_ms; }
+      }
+      continue;
+    }
+
+    if (cfg_peer_timeout_ms > 0) {
+      if (now_ns - peer->last_recv_ns > 1000000ULL * cfg_peer_timeout_ms) {
+        peer->missed_hbs++;
+        peer_down(peer, "heartbeat timeout");
+        next_ms = 0;  /* Start reconnecting right away. */
+        continue;
+      }
+      if (now_ns >= peer->last_hb_ns + hb_ns) {
+        /* Nothing since the last heartbeat: the peer's was missed. */
+        if (peer->last_recv_ns < peer->last_hb_ns) { peer->missed_hbs++; }
+        send(peer->sock, "hb\n", 3, 0);
+        peer->last_hb_ns = now_ns;
+      }
+      DUE(peer->last_hb_ns + hb_ns);
+      DUE(peer->last_recv_ns + 1000000ULL * cfg_peer_timeout_ms + 1);
+    }
+
+    if (cfg_ping_interval_ms == 0 || peer->recv_ns != 0) { continue; }  /* recv_ns: it's exiting. */
+    if (now_ns >= peer->next_ping_ns) {
+      len = snprintf(msg, sizeof(msg), "ping %llu\n", (unsigned long long)plat_wall_ns());
+      send(peer->sock, msg, len, 0);
+      peer->pings_sent++;
+      /* Fill the sample window quickly, then settle to the interval. */
+      peer->next_ping_ns = now_ns + 1000000ULL *
+          ((peer->pings_sent < PING_SAMPLES) ? PING_FAST_MS : cfg_ping_interval_ms);
+    }
+    DUE(peer->next_ping_ns);
+  }
+#undef DUE
+
+  if (next_ns != 0) {
+    wait_ms = (next_ns > now_ns) ? (int)((next_ns - now_ns + 999999) / 1000000) : 0;
+    if (next_ms < 0 || wait_ms < next_ms) { next_ms = wait_ms; }
+  }
+  return next_ms;
+}  /* peer_timers */
+
+
+/* A peer's "exit" carried the time to stop capturing, in its clock
+ * (0 if it didn't).  Adopt it in ours, unless we already have a stop
+ * time.  Without a clock estimate, fall back to our own cap_linger_ms. */
+void peer_stop_at(peer_t *peer, uint64_t peer_stop_ns) {
+  int64_t offset_ns;
+  uint64_t rtt_ns;
+
+  if (stop_wall_ns != 0) { return; }
+  if (peer_stop_ns != 0 && peer_clock(peer, &offset_ns, &rtt_ns)) {
+    stop_wall_ns = peer_stop_ns - offset_ns;
+    stats.stop_peer = peer;
+  } else {
+    stop_wall_ns = plat_wall_ns() + 1000000ULL * cfg_cap_linger_ms;
+  }
+}  /* peer_stop_at */
+
+
+/* Handle each complete line received from a peer:
+ *   "ping <t1>"            - answer "pong <t1> <t2> <t3>" (t2 = when the ping
+ *                            arrived, t3 = when the pong is sent).
+ *   "pong <t1> <t2> <t3>"  - a clock sample (NTP style, t4 = arrival).
+ *   "exit [<stop> [<n> [<reason>]]]" - trigger number n, or the answer to
+ *                            ours (reason: see stats.trigger_reason).
+ *   "hb"                   - heartbeat (any data will do).
+ *   "bye"                  - the peer is exiting; don't reconnect.
+ * All times are wall clock ns of the node that took them.  Returns 1 on
+ * "exit", leaving any lines after it for the next trigger (rearm), or
+ * when the last peer says "bye". */
+int peer_parse(peer_t *peer) {
+  uint64_t arrive_ns = plat_wall_ns();
+  unsigned long long t1, t2, t3, stop;
+  char msg[128];
+  char *line, *nl, *reason;
+  int len, slot, n, end;
+  int rc = 0;
+
+  peer->rbuf[peer->rlen] = '\0';
+  line = peer->rbuf;
+  while (rc == 0 && (nl = strchr(line, '\n')) != NULL) {
+    *nl = '\0';
+    if (sscanf(line, "ping %llu", &t1) == 1) {
+      len = snprintf(msg, sizeof(msg), "pong %llu %llu %llu\n", t1,
+          (unsigned long long)arrive_ns, (unsigned long long)plat_wall_ns());
+      send(peer->sock, msg, len, 0);
+    } else if (sscanf(line, "pong %llu %llu %llu", &t1, &t2, &t3) == 3) {
+      slot = peer->num_pings++ % PING_SAMPLES;
+      peer->ping_offset[slot] = ((int64_t)(t2 - t1) + (int64_t)(t3 - arrive_ns)) / 2;
+      peer->ping_rtt[slot] = (arrive_ns - t1) - (t3 - t2);
+    } else if (strncmp(line, "exit", 4) == 0) {
+      n = trigger_num + 1;
+      end = 0;
+      len = sscanf(line, "exit %llu %d%n", &stop, &n, &end);
+      if (len < 1) { stop = 0; }
+      reason = line + ((len == 2) ? end : (int)strlen(line));
+      reason += strspn(reason, " ");
+      /* An older trigger's answer that came in after we stopped waiting
+       * (rearm) is not a new trigger. */
+      if (n > trigger_num) {
+        if (peer_trigger_reason(reason)) {
+          fprintf(stderr, "INFO: peer %s: trigger reason: %s\n", peer->name, reason);
+        }
+        peer_stop_at(peer, stop);
+        rc = 1;
+      }
+    } else if (strcmp(line, "bye") == 0) {
+      peer_close(peer);
+      peer->gone = 1;
+      rc = (peer_count() == 0);
+      break;
+    }
+    line = nl + 1;
+  }
+  if (peer->gone) { return rc; }
+
+  /* Keep a partial line for next time (drop one too long to ever fit). */
+  peer->rlen -= (int)(line - peer->rbuf);
+  memmove(peer->rbuf, line, peer->rlen);
+  if (peer->rlen == (int)sizeof(peer->rbuf) - 1) { peer->rlen = 0; }
+  return rc;
+}  /* peer_parse */
+
+
+/* Read from a peer and handle what came in (see peer_parse).  A closed
+ * connection is not a trigger: see peer_down. */
+int peer_read(peer_t *peer) {
+  int len;
+
+  len = recv(peer->sock, peer->rbuf + peer->rlen, (int)sizeof(peer->rbuf) - 1 - peer->rlen, 0);
+  if (len <= 0) {
+    peer_down(peer, "closed");
+    return 0;
+  }
+  peer->last_recv_ns = plat_monotonic_ns();
+  peer->rlen += len;
+  return peer_parse(peer);
+}  /* peer_read */
+
+
+/* Wait up to timeout_ms for data from peers that haven't yet sent "exit",
+ * and handle it (and reconnects).  Returns the number that sent "exit". */
+int peer_poll(int timeout_ms) {
   fd_set rfds;
   struct timeval tv;
-  char buf[512];
-  int rc;
+  plat_sock_t max_sock = 0;
+  int rc, i;
+
+  FD_ZERO(&rfds);
+  for (i = 0; i < num_peers; i++) {
+    if (peers[i].recv_ns == 0 && peer_up(&peers[i])) {
+      FD_SET(peers[i].sock, &rfds);
+      if (peers[i].sock > max_sock) { max_sock = peers[i].sock; }
+    }
+  }
+  if (listen_sock != PLAT_INVALID_SOCK) {
+    FD_SET(listen_sock, &rfds);
+    if (listen_sock > max_sock) { max_sock = listen_sock; }
+  }
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  rc = select((int)(max_sock + 1), &rfds, NULL, NULL, &tv);
+  if (rc <= 0) { return 0; }
+
+  if (listen_sock != PLAT_INVALID_SOCK && FD_ISSET(listen_sock, &rfds)) {
+    peer_accept();  /* Not in rfds: its data comes next time. */
+  }
+  rc = 0;
+  for (i = 0; i < num_peers; i++) {
+    if (peers[i].recv_ns == 0 && peer_up(&peers[i]) && FD_ISSET(peers[i].sock, &rfds)) {
+      if (peer_read(&peers[i])) {
+        peers[i].recv_ns = plat_monotonic_ns();
+        rc++;
+      }
+    }
+  }
+  return rc;
+}  /* peer_poll */
+
+
+/* Tell all peers about the trigger (ours, or one we relay) and when to
+ * stop, collect their answers and report. */
+void peer_trigger(void) {
+  uint64_t deadline_ns;
+  char msg[192];
+  int num_waiting;
+  int len, i;
+
+  /* If the trigger is ours, so is the stop time. */
+  if (stop_wall_ns == 0) {
+    stop_wall_ns = plat_wall_ns() + 1000000ULL * cfg_cap_linger_ms;
+  }
+
+  /* Notify all peers we're exiting and when to stop (a hub thus relays a
+   * trigger from one peer to the rest).  Each peer answers with its own
+   * "exit", so the time until we hear back is the trigger's round trip to
+   * that peer.  A peer that is reconnecting gets it once it is back.
+   * Don't hold up shutdown for more than a second, though. */
+  len = snprintf(msg, sizeof(msg), "exit %llu %d %s\n", (unsigned long long)stop_wall_ns, trigger_num + 1,
+      stats.trigger_reason);
+  deadline_ns = plat_monotonic_ns() + 1000000000;
+  while (plat_monotonic_ns() < deadline_ns) {
+    num_waiting = 0;
+    for (i = 0; i < num_peers; i++) {
+      if (peers[i].gone) { continue; }
+      if (!peer_up(&peers[i]) && cfg_init_port > 0) { peer_reconnect(&peers[i]); }
+      if (peer_up(&peers[i]) && peers[i].sent_ns == 0) {
+        peers[i].sent_ns = plat_monotonic_ns();
+        if (stats.sent_ns == 0) { stats.sent_ns = peers[i].sent_ns; }
+        send(peers[i].sock, msg, len, 0);
+      }
+      if (peers[i].recv_ns == 0 || peers[i].sent_ns == 0) { num_waiting++; }
+    }
+    if (num_waiting == 0) { break; }
+    peer_poll(10);
+  }
+
+  for (i = 0; i < num_peers; i++) {
+    if (peers[i].gone) {
+      /* Exited. */
+    } else if (peers[i].sent_ns == 0 && peers[i].recv_ns == 0) {
+      fprintf(stderr, "INFO: peer %s: not connected; trigger not sent\n", peers[i].name);
+    } else if (peers[i].recv_ns == 0) {
+      fprintf(stderr, "INFO: peer %s: no response to trigger\n", peers[i].name);
+    } else if (peers[i].recv_ns < peers[i].sent_ns) {
+      fprintf(stderr, "INFO: peer %s: sent trigger\n", peers[i].name);
+    } else {
+      fprintf(stderr, "INFO: peer %s: trigger round trip %llu us\n", peers[i].name,
+          (unsigned long long)((peers[i].recv_ns - peers[i].sent_ns) / 1000));
+    }
+  }
+}  /* peer_trigger */
+
+
+/* Say "bye" to the connected peers, so they don't wait for us to
+ * reconnect, and close the connections. */
+void peer_bye(void) {
+  int i;
+
+  for (i = 0; i < num_peers; i++) {
+    if (peer_up(&peers[i])) { send(peers[i].sock, "bye\n", 4, 0); }
+    peer_close(&peers[i]);
+  }
+  if (listen_sock != PLAT_INVALID_SOCK) { plat_close_sock(listen_sock); }
+}  /* peer_bye */
+
+
+void *peer_comm_thread(void *arg) {
+  int timeout_ms;
   (void)arg;
 
+  if (mcast_sock != PLAT_INVALID_SOCK) {
+    while (!exiting) {
+      if (mcast_poll(100)) {
+        exiting = 1;
+      }
+    }
+    mcast_trigger();
+    return NULL;
+  }
+
   while (!exiting) {
-    FD_ZERO(&rfds);
-    FD_SET(peer_sock, &rfds);
-    tv.tv_sec = 0;
-    tv.tv_usec = 100000;  /* 100 ms */
-    rc = select((int)(peer_sock + 1), &rfds, NULL, NULL, &tv);
-    if (rc > 0) {
-      rc = recv(peer_sock, buf, sizeof(buf), 0);
-      exiting = 1;  /* Got data or peer closed. */
+    timeout_ms = peer_timers();
+    if (timeout_ms < 0 || timeout_ms > 100) { timeout_ms = 100; }
+    if (peer_poll(timeout_ms) > 0) {
+      exiting = 1;
     }
   }
 
-  /* Notify peer we're exiting. */
-  send(peer_sock, "exit\n", 5, 0);
-  plat_close_sock(peer_sock);
+  peer_trigger();
   return NULL;
 }  /* peer_comm_thread */
 
 
+/* Single-threaded alternative to peer_comm_thread + file_mon_thread: one
+ * epoll wait covers the peer sockets, the log files' inotify descriptor,
+ * a wakeup eventfd and a signalfd, so nothing runs until there is work
+ * (unless some file has to be polled).  Returns 1 if the log files have
+ * to be polled. */
+int event_loop_open(void) {
+  int i;
+
+  E(plat_evl_add_wake(evl, EV_ID_WAKE) != 0);
+  E(plat_evl_add_signals(evl, EV_ID_SIG) != 0);
+  for (i = 0; i < num_peers; i++) {
+    if (peer_up(&peers[i])) { E(plat_evl_add_sock(evl, peers[i].sock, i) != 0); }
+  }
+  if (listen_sock != PLAT_INVALID_SOCK) {
+    E(plat_evl_add_sock(evl, listen_sock, EV_ID_LISTEN) != 0);
+  }
+  if (mcast_sock != PLAT_INVALID_SOCK) {
+    E(plat_evl_add_sock(evl, mcast_sock, EV_ID_MCAST) != 0);
+  }
+  return (plat_evl_add_mon(evl, mon_watch, EV_ID_MON) != 0);
+}  /* event_loop_open */
+
+
+/* Run until a trigger, then pass it on. */
+void event_loop(int mon_polling) {
+  int ids[64];
+  int n, i, sigs, timeout_ms;
+
+  while (!exiting) {
+    mon_polling = mon_polling || plat_mon_polling(mon_watch);
+    timeout_ms = peer_timers();
+    if (mon_polling && (timeout_ms < 0 || timeout_ms > 100)) { timeout_ms = 100; }
+    n = plat_evl_wait(evl, timeout_ms, ids, 64);
+    if (n == 0 && mon_polling) {
+      mon_check(0);
+    }
+
+    for (i = 0; i < n && !exiting; i++) {
+      if (ids[i] >= 0) {
+        peer_t *peer = &peers[ids[i]];
+        if (peer_up(peer) && peer_read(peer)) {
+          peer->recv_ns = plat_monotonic_ns();
+          exiting = 1;
+        }
+      } else if (ids[i] == EV_ID_LISTEN) {
+        peer_accept();
+      } else if (ids[i] == EV_ID_MCAST) {
+        if (mcast_recv()) {
+          exiting = 1;
+        }
+      } else if (ids[i] == EV_ID_MON) {
+        mon_check(0);
+      } else if (ids[i] == EV_ID_SIG) {
+        sigs = plat_evl_signals(evl);
+        if ((sigs & PLAT_SIG_CHLD) && cap_running && plat_proc_exited(cap_proc)) {
+          fprintf(stderr, "WARNING: capture process exited early.\n");
+          cap_running = 0;
+        }
+        if (sigs & PLAT_SIG_INT) {
+          if (cap_running) { plat_kill_proc(cap_proc); }
+          if (cap != NULL) { cap_close(cap, NULL, NULL); }  /* Finish the file. */
+          peer_bye();
+          exit(1);
+        }
+      }
+      /* EV_ID_WAKE: just re-check exiting. */
+    }
+  }
+
+  if (mcast_sock != PLAT_INVALID_SOCK) {
+    mcast_trigger();
+  } else {
+    peer_trigger();
+  }
+}  /* event_loop */
+
+
+/* Write a JSON string (s may be NULL). */
+void json_str(FILE *fp, const char *s) {
+  if (s == NULL) { fputs("null", fp); return; }
+  fputc('"', fp);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\') { fprintf(fp, "\\%c", *s); }
+    else if ((unsigned char)*s < 0x20) { fprintf(fp, "\\u%04x", (unsigned char)*s); }
+    else { fputc(*s, fp); }
+  }
+  fputc('"', fp);
+}  /* json_str */
+
+
+/* Per-trigger report: trigger path stage durations and scan counters,
+ * to stderr and (if stats_file is set) as JSON. */
+void report_write(void) {
+  struct { const char *name; uint64_t from_ns; uint64_t to_ns; } stages[6];
+  uint64_t peer_msg_ns = mcast_recv_ns;
+  uint64_t lines = 0, bytes = 0;
+  const char *trigger;
+  const char *stop_from = stats.stop_peer ? stats.stop_peer->name : "local";
+  const char *trigger_pat = NULL;
+  const char *trigger_kind = NULL;
+  mon_rate_t *rate = NULL;
+  mwork_stats_t wst;
+  int64_t offset_ns;
+  uint64_t rtt_ns;
+  FILE *fp = NULL;
+  char *path;
+  int num_stages = 0;
+  int i;
+
+  /* First message from any peer: its trigger, or its answer to ours. */
+  for (i = 0; i < num_peers; i++) {
+    if (peers[i].recv_ns != 0 && (peer_msg_ns == 0 || peers[i].recv_ns < peer_msg_ns)) {
+      peer_msg_ns = peers[i].recv_ns;
+    }
+  }
+  for (i = 0; i < num_mon_files; i++) {
+    lines += mon_files[i].lines;
+    bytes += mon_files[i].bytes;
+  }
+
+#define STAGE(n_, f_, t_) do { \
+  stages[num_stages].name = (n_); \
+  stages[num_stages].from_ns = (f_); \
+  stages[num_stages].to_ns = (t_); \
+  num_stages++; \
+} while (0)
+  if (stats.matched_ns != 0) {
+    trigger = "local";
+    STAGE("observed_to_matched", stats.observed_ns, stats.matched_ns);
+    STAGE("matched_to_sent", stats.matched_ns, stats.sent_ns);
+    STAGE("sent_to_peer_msg", stats.sent_ns, peer_msg_ns);
+    STAGE("matched_to_kill", stats.matched_ns, stats.kill_ns);
+  } else {
+    trigger = (peer_msg_ns != 0) ? "peer" : "none";
+    STAGE("peer_msg_to_sent", peer_msg_ns, stats.sent_ns);
+    STAGE("peer_msg_to_kill", peer_msg_ns, stats.kill_ns);
+  }
+  STAGE("kill_to_cap_exit", stats.kill_ns, stats.cap_exit_ns);
+#undef STAGE
+
+  if (stats.trigger_file != NULL && stats.trigger_pat >= 0) {
+    trigger_pat = stats.trigger_file->patterns->pat_strs[stats.trigger_pat];
+    trigger_kind = mon_pat_kind(stats.trigger_file->patterns, stats.trigger_pat);
+    rate = (mon_rate_t *)stats.trigger_file->patterns->pat_data[stats.trigger_pat];
+  }
+  fprintf(stderr, "INFO: report: trigger=%s trigger_num=%d", trigger, trigger_num + 1);
+  if (stats.trigger_file != NULL) {
+    fprintf(stderr, " mon_file='%s'", stats.trigger_file->path);
+  }
+  if (trigger_pat != NULL) {
+    fprintf(stderr, " %s='%s'", trigger_kind, trigger_pat);
+  }
+  if (rate != NULL) {
+    fprintf(stderr, " mon_rate=%d/%d rate_count=%d rate_span_ms=%.1f", rate->count, rate->window_ms,
+        rate->fired_total, (double)rate->fired_span_ns / 1000000.0);
+  }
+  if (stats.trigger_reason[0] != '\0') {
+    fprintf(stderr, " trigger_reason='%s'", stats.trigger_reason);
+  }
+  fprintf(stderr, "\n");
+  for (i = 0; i < num_stages; i++) {
+    if (stages[i].from_ns != 0 && stages[i].to_ns >= stages[i].from_ns) {
+      fprintf(stderr, "INFO: report: %s_us=%.1f\n", stages[i].name,
+          (double)(stages[i].to_ns - stages[i].from_ns) / 1000.0);
+    }
+  }
+  fprintf(stderr, "INFO: report: lines=%llu bytes=%llu scan_cpu_us=%.1f\n",
+      (unsigned long long)lines, (unsigned long long)bytes,
+      (double)stats.scan_cpu_ns / 1000.0);
+  for (i = 0; i < num_mon_files; i++) {
+    fprintf(stderr, "INFO: report: mon_file '%s': %llu bytes, %llu lines (%llu longer than the buffer)\n",
+        mon_files[i].path, (unsigned long long)mon_files[i].bytes,
+        (unsigned long long)mon_files[i].lines, (unsigned long long)mon_files[i].long_lines);
+  }
+  for (i = 0; mon_scanner.pool != NULL && i < cfg_mon_workers; i++) {
+    mwork_stats(mon_scanner.pool, i, &wst);
+    fprintf(stderr, "INFO: report: mon_worker %d: lines=%llu bytes=%llu batches=%llu busy_us=%.1f lines_per_sec=%.0f\n", i,
+        (unsigned long long)wst.lines, (unsigned long long)wst.bytes, (unsigned long long)wst.batches,
+        (double)wst.busy_ns / 1000.0,
+        (wst.busy_ns > 0) ? (double)wst.lines * 1e9 / (double)wst.busy_ns : 0.0);
+  }
+  /* Offset = peer's clock minus ours; the error is at most rtt / 2. */
+  for (i = 0; i < num_peers; i++) {
+    if (peer_clock(&peers[i], &offset_ns, &rtt_ns)) {
+      fprintf(stderr, "INFO: report: peer %s: clock_offset_us=%.1f error_us=%.1f samples=%d\n",
+          peers[i].name, (double)offset_ns / 1000.0, (double)rtt_ns / 2000.0, peers[i].num_pings);
+    } else {
+      fprintf(stderr, "INFO: report: peer %s: no clock samples\n", peers[i].name);
+    }
+    fprintf(stderr, "INFO: report: peer %s: reconnects=%d missed_heartbeats=%llu\n", peers[i].name,
+        (peers[i].connects > 0) ? peers[i].connects - 1 : 0, (unsigned long long)peers[i].missed_hbs);
+  }
+  if (cfg_cap_iface != NULL) {
+    fprintf(stderr, "INFO: report: cap_packets=%llu cap_bytes=%llu cap_drops=%llu cap_evicted=%llu cap_cpu_us=%.1f\n",
+        (unsigned long long)stats.cap.packets, (unsigned long long)stats.cap.bytes,
+        (unsigned long long)stats.cap.drops, (unsigned long long)stats.cap.evicted,
+        (double)stats.cap.cpu_ns / 1000.0);
+    /* Throughput is over the time spent in write calls. */
+    fprintf(stderr, "INFO: report: cap_write_bytes=%llu cap_write_mb_per_s=%.1f cap_write_queue_hwm=%d/%d cap_write_stalls=%llu\n",
+        (unsigned long long)stats.cap.wr.bytes_out,
+        (stats.cap.wr.write_ns > 0) ? (double)stats.cap.wr.bytes_out * 1000.0 / (double)stats.cap.wr.write_ns : 0.0,
+        stats.cap.wr.queue_hwm, stats.cap.wr.queue_size, (unsigned long long)stats.cap.wr.stalls);
+    if (cfg_cap_compress > 0) {
+      fprintf(stderr, "INFO: report: cap_file_bytes=%llu cap_compress_ratio=%.2f\n",
+          (unsigned long long)stats.cap.file_bytes,
+          (stats.cap.file_bytes > 0) ? (double)stats.cap.file_raw_bytes / (double)stats.cap.file_bytes : 0.0);
+    }
+    for (i = 0; cfg_cap_threads > 1 && i < cfg_cap_threads; i++) {
+      fprintf(stderr, "INFO: report: cap thread %d: packets=%llu drops=%llu evicted=%llu cpu_us=%.1f write_queue_hwm=%d write_stalls=%llu\n", i,
+          (unsigned long long)stats.cap_threads[i].packets,
+          (unsigned long long)stats.cap_threads[i].drops,
+          (unsigned long long)stats.cap_threads[i].evicted,
+          (double)stats.cap_threads[i].cpu_ns / 1000.0,
+          stats.cap_threads[i].wr.queue_hwm,
+          (unsigned long long)stats.cap_threads[i].wr.stalls);
+    }
+  }
+  if (stats.kill_wall_ns != 0) {
+    /* How far from the agreed stop time we actually stopped. */
+    fprintf(stderr, "INFO: report: stop_from=%s stop_late_us=%.1f\n", stop_from,
+        (double)(int64_t)(stats.kill_wall_ns - stop_wall_ns) / 1000.0);
+  }
+
+  if (cfg_stats_file == NULL) { return; }
+  path = cfg_subst_n(cfg_stats_file, trigger_num + 1);
+  fp = fopen(path, "w");  E(fp == NULL);
+  free(path);
+  fprintf(fp, "{\n  \"trigger\": \"%s\",\n  \"trigger_num\": %d,\n  \"trigger_file\": ", trigger, trigger_num + 1);
+  json_str(fp, stats.trigger_file ? stats.trigger_file->path : NULL);
+  fprintf(fp, ",\n  \"trigger_pattern\": ");
+  json_str(fp, trigger_pat);
+  if (rate != NULL) {
+    fprintf(fp, ",\n  \"trigger_rate\": {\"count\": %d, \"window_ms\": %d, \"observed_count\": %d, \"observed_span_ns\": %llu}",
+        rate->count, rate->window_ms, rate->fired_total, (unsigned long long)rate->fired_span_ns);
+  } else {
+    fprintf(fp, ",\n  \"trigger_rate\": null");
+  }
+  fprintf(fp, ",\n  \"trigger_reason\": ");
+  json_str(fp, (stats.trigger_reason[0] != '\0') ? stats.trigger_reason : NULL);
+  fprintf(fp, ",\n  \"run_ns\": %llu,\n",
+      (unsigned long long)(plat_monotonic_ns() - stats.start_ns));
+  for (i = 0; i < num_stages; i++) {
+    if (stages[i].from_ns != 0 && stages[i].to_ns >= stages[i].from_ns) {
+      fprintf(fp, "  \"%s_ns\": %llu,\n", stages[i].name,
+          (unsigned long long)(stages[i].to_ns - stages[i].from_ns));
+    } else {
+      fprintf(fp, "  \"%s_ns\": null,\n", stages[i].name);
+    }
+  }
+  fprintf(fp, "  \"lines\": %llu,\n  \"bytes\": %llu,\n  \"scan_cpu_ns\": %llu,\n",
+      (unsigned long long)lines, (unsigned long long)bytes,
+      (unsigned long long)stats.scan_cpu_ns);
+  fprintf(fp, "  \"files\": [");
+  for (i = 0; i < num_mon_files; i++) {
+    fprintf(fp, "%s\n    {\"path\": ", (i > 0) ? "," : "");
+    json_str(fp, mon_files[i].path);
+    fprintf(fp, ", \"bytes\": %llu, \"lines\": %llu, \"long_lines\": %llu}",
+        (unsigned long long)mon_files[i].bytes, (unsigned long long)mon_files[i].lines,
+        (unsigned long long)mon_files[i].long_lines);
+  }
+  fprintf(fp, "\n  ],\n  \"mon_workers\": [");
+  for (i = 0; mon_scanner.pool != NULL && i < cfg_mon_workers; i++) {
+    mwork_stats(mon_scanner.pool, i, &wst);
+    fprintf(fp, "%s\n    {\"lines\": %llu, \"bytes\": %llu, \"batches\": %llu, \"busy_ns\": %llu, \"lines_per_sec\": %.0f}",
+        (i > 0) ? "," : "", (unsigned long long)wst.lines, (unsigned long long)wst.bytes,
+        (unsigned long long)wst.batches, (unsigned long long)wst.busy_ns,
+        (wst.busy_ns > 0) ? (double)wst.lines * 1e9 / (double)wst.busy_ns : 0.0);
+  }
+  fprintf(fp, "\n  ],\n  \"peers\": [");
+  for (i = 0; i < num_peers; i++) {
+    fprintf(fp, "%s\n    {\"name\": ", (i > 0) ? "," : "");
+    json_str(fp, peers[i].name);
+    if (peer_clock(&peers[i], &offset_ns, &rtt_ns)) {
+      fprintf(fp, ", \"clock_offset_ns\": %lld, \"clock_error_ns\": %llu",
+          (long long)offset_ns, (unsigned long long)(rtt_ns / 2));
+    } else {
+      fprintf(fp, ", \"clock_offset_ns\": null, \"clock_error_ns\": null");
+    }
+    fprintf(fp, ", \"clock_samples\": %d, \"reconnects\": %d, \"missed_heartbeats\": %llu}", peers[i].num_pings,
+        (peers[i].connects > 0) ? peers[i].connects - 1 : 0, (unsigned long long)peers[i].missed_hbs);
+  }
+  fprintf(fp, "\n  ],\n");
+  if (cfg_cap_iface != NULL) {
+    fprintf(fp, "  \"cap_packets\": %llu,\n  \"cap_bytes\": %llu,\n  \"cap_drops\": %llu,\n"
+        "  \"cap_evicted\": %llu,\n  \"cap_cpu_ns\": %llu,\n",
+        (unsigned long long)stats.cap.packets, (unsigned long long)stats.cap.bytes,
+        (unsigned long long)stats.cap.drops, (unsigned long long)stats.cap.evicted,
+        (unsigned long long)stats.cap.cpu_ns);
+    fprintf(fp, "  \"cap_write_bytes\": %llu,\n  \"cap_write_ns\": %llu,\n"
+        "  \"cap_write_queue_hwm\": %d,\n  \"cap_write_queue_size\": %d,\n  \"cap_write_stalls\": %llu,\n"
+        "  \"cap_file_bytes\": %llu,\n  \"cap_file_raw_bytes\": %llu,\n",
+        (unsigned long long)stats.cap.wr.bytes_out, (unsigned long long)stats.cap.wr.write_ns,
+        stats.cap.wr.queue_hwm, stats.cap.wr.queue_size, (unsigned long long)stats.cap.wr.stalls,
+        (unsigned long long)stats.cap.file_bytes, (unsigned long long)stats.cap.file_raw_bytes);
+    fprintf(fp, "  \"cap_threads\": [");
+    for (i = 0; i < cfg_cap_threads; i++) {
+      fprintf(fp, "%s\n    {\"packets\": %llu, \"bytes\": %llu, \"drops\": %llu, \"evicted\": %llu, \"cpu_ns\": %llu, "
+          "\"write_queue_hwm\": %d, \"write_stalls\": %llu}",
+          (i > 0) ? "," : "",
+          (unsigned long long)stats.cap_threads[i].packets,
+          (unsigned long long)stats.cap_threads[i].bytes,
+          (unsigned long long)stats.cap_threads[i].drops,
+          (unsigned long long)stats.cap_threads[i].evicted,
+          (unsigned long long)stats.cap_threads[i].cpu_ns,
+          stats.cap_threads[i].wr.queue_hwm,
+          (unsigned long long)stats.cap_threads[i].wr.stalls);
+    }
+    fprintf(fp, "\n  ],\n");
+  }
+  fprintf(fp, "  \"stop_from\": ");
+  json_str(fp, stop_from);
+  fprintf(fp, ",\n  \"stop_wall_ns\": %llu,\n  \"stop_late_ns\": ", (unsigned long long)stop_wall_ns);
+  if (stats.kill_wall_ns != 0) {
+    fprintf(fp, "%lld\n}\n", (long long)(stats.kill_wall_ns - stop_wall_ns));
+  } else {
+    fprintf(fp, "null\n}\n");
+  }
+  fclose(fp);
+}  /* report_write */
+
+
+/* Stop this trigger's capture at the agreed time.  next: rearming, so
+ * start the next trigger's capture first (a new file from the same
+ * in-process capture, or a new cap_cmd process that overlaps this one),
+ * leaving no gap. */
+void cap_stop(int next) {
+  plat_proc_t next_proc;
+  uint64_t now_ns;
+  char *path;
+
+  /* Let capture run a bit longer to catch trailing packets, then stop.
+   * With peers, all nodes stop at the triggering node's trigger time plus
+   * its cap_linger_ms (each converted to its own clock). */
+  if (stop_wall_ns == 0) {
+    stop_wall_ns = plat_wall_ns() + 1000000ULL * cfg_cap_linger_ms;
+  }
+  if (next && cfg_cap_cmd != NULL) {
+    path = cfg_subst_n(cfg_cap_cmd, trigger_num + 2);
+    E(plat_spawn_cmd(path, &next_proc));
+    free(path);
+  }
+  /* The in-process capture cuts at exactly the stop time by packet
+   * timestamp, however late we get to it. */
+  if (cap != NULL) {
+    if (next) {
+      path = cfg_subst_n(cfg_cap_file, trigger_num + 2);
+      cap_rotate_at(cap, stop_wall_ns, path);
+      free(path);
+    } else {
+      cap_stop_at(cap, stop_wall_ns);
+    }
+  }
+  now_ns = plat_wall_ns();
+  if (stop_wall_ns > now_ns) {
+    plat_sleep_ms((int)((stop_wall_ns - now_ns + 999999) / 1000000));
+  }
+  stats.kill_wall_ns = plat_wall_ns();
+  stats.kill_ns = plat_monotonic_ns();
+  if (cap != NULL) {
+    if (next) {
+      cap_rotate_wait(cap, &stats.cap, stats.cap_threads);
+    } else {
+      cap_close(cap, &stats.cap, stats.cap_threads);
+    }
+  } else {
+    if (cap_running) {
+      plat_kill_proc(cap_proc);
+      plat_wait_proc(cap_proc);
+    }
+    if (next) {
+      cap_proc = next_proc;
+      cap_running = 1;
+    }
+  }
+  stats.cap_exit_ns = plat_monotonic_ns();
+}  /* cap_stop */
+
+
+/* Get ready for the next trigger (rearm). */
+void rearm(void) {
+  cap_stats_t *cap_threads = stats.cap_threads;
+  int i;
+
+  trigger_num++;
+  memset(&stats, 0, sizeof(stats));
+  stats.cap_threads = cap_threads;
+  stop_wall_ns = 0;
+  mcast_recv_ns = 0;
+  exiting = 0;
+  stats.start_ns = plat_monotonic_ns();
+  fprintf(stderr, "INFO: rearmed for trigger %d\n", trigger_num + 1);
+
+  /* A peer may already have sent the next trigger.  (Nothing was read
+   * while stopping the capture; don't count that against heartbeats.) */
+  for (i = 0; i < num_peers; i++) {
+    peers[i].sent_ns = 0;
+    peers[i].recv_ns = 0;
+    peers[i].last_recv_ns = peers[i].last_hb_ns = stats.start_ns;
+    if (peer_up(&peers[i]) && peer_parse(&peers[i])) {
+      peers[i].recv_ns = plat_monotonic_ns();
+      exiting = 1;
+    }
+  }
+  mon_rearm();
+}  /* rearm */
+
+
 int main(int argc, char **argv) {
   plat_thread_t peer_thr, file_thr;
+  int mon_polling = 0;
+  int next;
+  char *path;
+  int i;
 
   E(argc != 2);
 
   E(plat_init());
+#ifdef RE_GEN_PATTERNS
+  re_set_gen_table(re_gen_patterns);
+#endif
   cfg_parse(argv[1]);
 
   /* Start capture subprocess before connecting, so it is already
    * capturing when application traffic begins. */
   if (cfg_cap_cmd != NULL) {
-    E(plat_spawn_cmd(cfg_cap_cmd, &cap_proc));
+    path = cfg_subst_n(cfg_cap_cmd, 1);
+    E(plat_spawn_cmd(path, &cap_proc));
+    free(path);
     cap_running = 1;
     plat_install_ctrl_handler(&cap_proc, &cap_running);
   }
+  if (cfg_cap_iface != NULL) {
+    cap_cfg_t cap_cfg;
+    memset(&cap_cfg, 0, sizeof(cap_cfg));
+    path = cfg_subst_n(cfg_cap_file, 1);
+    cap_cfg.iface = cfg_cap_iface;
+    cap_cfg.path = path;
+    cap_cfg.pre_bytes = (size_t)cfg_cap_pre_mb * 1024 * 1024;
+    cap_cfg.pre_ns = (uint64_t)cfg_cap_pre_ms * 1000000;
+    cap_cfg.threads = cfg_cap_threads;
+    cap_cfg.fanout_cpu = cfg_cap_fanout_cpu;
+    cap_cfg.cpus = cfg_cap_cpus;
+    cap_cfg.filter = cfg_cap_filter;
+    cap_cfg.direct = cfg_cap_direct;
+    cap_cfg.compress = cfg_cap_compress;
+    stats.cap_threads = (cap_stats_t *)calloc(cfg_cap_threads, sizeof(cap_stats_t));  E(stats.cap_threads == NULL);
+    cap = cap_open(&cap_cfg);
+    if (cap == NULL) {
+      fprintf(stderr, "ERROR: cap_iface is not supported on this platform\n");
+      exit(1);
+    }
+    free(path);
+  }
 
   /* Establish connection before opening log file, so that both
    * instances are connected before either starts monitoring. */
-  peer_sock = peer_connect();
-  mon_fp = mon_open();
+  if (cfg_mcast_port > 0) {
+    mcast_open();
+  } else {
+    peer_connect();
+  }
+  mon_open();
+  stats.start_ns = plat_monotonic_ns();
+
+  if (cfg_event_loop) {
+    evl = plat_evl_create();
+  }
+  if (evl != NULL) {
+    mon_polling = event_loop_open();
+    /* A capture that died before signals were routed to the loop. */
+    if (cap_running && plat_proc_exited(cap_proc)) {
+      fprintf(stderr, "WARNING: capture process exited early.\n");
+      cap_running = 0;
+    }
+  }
+  /* After the event loop routes signals to itself (so the workers don't
+   * take them). */
+  if (cfg_mon_workers > 0) {
+    mon_scanner.pool = mwork_create(cfg_mon_workers, cfg_mon_worker_cpus);
+  }
 
-  E(plat_thread_create(&peer_thr, peer_comm_thread, NULL));
-  E(plat_thread_create(&file_thr, file_mon_thread, NULL));
+  /* One pass per trigger; with rearm, the connections, log files and
+   * in-process capture carry over to the next one. */
+  while (1) {
+    if (evl != NULL) {
+      event_loop(mon_polling);
+    } else {
+      /* Portable backend. */
+      E(plat_thread_create(&peer_thr, peer_comm_thread, NULL));
+      E(plat_thread_create(&file_thr, file_mon_thread, NULL));
 
-  plat_thread_join(file_thr);
-  plat_thread_join(peer_thr);
+      plat_thread_join(file_thr);
+      plat_thread_join(peer_thr);
+    }
 
-  /* Let capture run a bit longer to catch trailing packets, then stop. */
-  if (cap_running) {
-    if (cfg_cap_linger_ms > 0) {
-      plat_sleep_ms(cfg_cap_linger_ms);
+    next = cfg_rearm && (cfg_rearm_max == 0 || trigger_num + 1 < cfg_rearm_max);
+    if (next && num_peers > 0 && peer_count() == 0) {
+      fprintf(stderr, "INFO: no peers left; not rearming\n");
+      next = 0;
+    }
+    if (cfg_cap_cmd != NULL || cap != NULL) {
+      cap_stop(next);
     }
-    plat_kill_proc(cap_proc);
-    plat_wait_proc(cap_proc);
+    report_write();
+    if (!next) { break; }
+    rearm();
   }
 
-  if (cfg_mon_pattern) re_free(cfg_mon_pattern);
+  peer_bye();
+  if (evl != NULL) { plat_evl_close(evl); }
+  mon_close();
+  if (mcast_sock != PLAT_INVALID_SOCK) { plat_close_sock(mcast_sock); }
+
+  for (i = 0; i < num_mon_files; i++) {
+    free(mon_files[i].path);
+    free(mon_files[i].carry);
+    if (mon_files[i].stream != NULL) { mpat_stream_free(mon_files[i].stream); }
+  }
+  free(mon_files);
+  free(peers);
+  for (i = 0; i < cfg_num_mon_specs; i++) {
+    if (cfg_mon_specs[i].patterns) mon_pats_free(cfg_mon_specs[i].patterns);
+    free(cfg_mon_specs[i].path);
+  }
+  free(cfg_mon_specs);
+  if (cfg_mon_patterns) mon_pats_free(cfg_mon_patterns);
   if (cfg_cap_cmd) free(cfg_cap_cmd);
-  if (cfg_mon_file) free(cfg_mon_file);
-  if (cfg_mon_pat_str ) free(cfg_mon_pat_str);
+  if (cfg_cap_iface) free(cfg_cap_iface);
+  if (cfg_cap_file) free(cfg_cap_file);
+  if (cfg_cap_cpus) free(cfg_cap_cpus);
+  if (cfg_mon_worker_cpus) free(cfg_mon_worker_cpus);
+  if (cfg_cap_filter) bpf_free(cfg_cap_filter);
+  if (stats.cap_threads) free(stats.cap_threads);
+  if (cfg_stats_file) free(cfg_stats_file);
 
   return 0;
 }  /* main */
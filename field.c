@@ -0,0 +1,251 @@
+/* field.c - Structured log field matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "field.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* Returns the first byte at or after p that is one of the n chars (at
+ * most 8), or end.  With SSE2, 16 bytes are checked at a time, so long
+ * strings and messages are skipped quickly. */
+static const char *scan_to(const char *p, const char *end, const char *chars, int n) {
+#ifdef __SSE2__
+  __m128i set[8];
+  int i, mask;
+
+  for (i = 0; i < n; i++) {
+    set[i] = _mm_set1_epi8(chars[i]);
+  }
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i hit = _mm_cmpeq_epi8(v, set[0]);
+    for (i = 1; i < n; i++) {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, set[i]));
+    }
+    mask = _mm_movemask_epi8(hit);
+    if (mask != 0) {
+      return p + __builtin_ctz((unsigned)mask);
+    }
+    p += 16;
+  }
+#endif
+  while (p < end && memchr(chars, *p, n) == NULL) {
+    p++;
+  }
+  return p;
+}  /* scan_to */
+
+
+/* p is just past a string's opening quote.  Returns its closing quote,
+ * or end if it isn't closed. */
+static const char *skip_string(const char *p, const char *end) {
+  while ((p = scan_to(p, end, "\"\\", 2)) < end) {
+    if (*p == '"') { return p; }
+    if (end - p < 2) { break; }
+    p += 2;  /* Backslash escape. */
+  }
+  return end;
+}  /* skip_string */
+
+
+static const char *skip_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+    p++;
+  }
+  return p;
+}  /* skip_ws */
+
+
+/* JSON: only quotes and brackets are looked at; a string followed by a
+ * colon at depth 1 is a key. */
+static int json_find(const char *p, const char *end, const char *key, int key_len,
+    const char **val, int *val_len) {
+  const char *s, *q;
+  int depth = 0;
+
+  while ((p = scan_to(p, end, "\"{}[]", 5)) < end) {
+    if (*p == '"') {
+      s = p + 1;
+      q = skip_string(s, end);
+      if (q == end) { return 0; }
+      p = q + 1;
+      if (depth != 1) { continue; }
+      p = skip_ws(p, end);
+      if (p == end || *p != ':') { continue; }  /* A value, not a key. */
+      p = skip_ws(p + 1, end);
+      if (q - s != key_len || memcmp(s, key, key_len) != 0) { continue; }
+
+      /* Found the key. */
+      if (p == end || *p == '{' || *p == '[') { return 0; }
+      if (*p == '"') {
+        q = skip_string(p + 1, end);
+        *val = p + 1;
+        *val_len = (int)(q - (p + 1));
+      } else {
+        q = scan_to(p, end, ",}] \t\r\n", 7);
+        *val = p;
+        *val_len = (int)(q - p);
+      }
+      return 1;
+    }
+    if (*p == '{' || *p == '[') {
+      depth++;
+    } else if (--depth == 0) {
+      return 0;  /* End of the object. */
+    }
+    p++;
+  }
+  return 0;
+}  /* json_find */
+
+
+/* key=value pairs separated by blanks; a value may be quoted.  Other
+ * words (and quoted text) are skipped. */
+static int kv_find(const char *p, const char *end, const char *key, int key_len,
+    const char **val, int *val_len) {
+  const char *k, *v;
+
+  while ((p = skip_ws(p, end)) < end) {
+    k = p;
+    p = scan_to(p, end, "= \t\"", 4);
+    if (p == end) { return 0; }
+    if (*p == '=') {
+      int is_key = (p - k == key_len && memcmp(k, key, key_len) == 0);
+      p++;
+      if (p < end && *p == '"') {
+        v = p + 1;
+        p = skip_string(v, end);
+        if (is_key) { *val = v; *val_len = (int)(p - v); return 1; }
+        if (p < end) { p++; }
+      } else {
+        v = p;
+        p = scan_to(p, end, " \t", 2);
+        if (is_key) { *val = v; *val_len = (int)(p - v); return 1; }
+      }
+    } else if (*p == '"') {
+      p = skip_string(p + 1, end);
+      if (p < end) { p++; }
+    }
+  }
+  return 0;
+}  /* kv_find */
+
+
+int field_find(const char *text, int text_len, const char *key, int key_len,
+    const char **val, int *val_len) {
+  const char *end = text + text_len;
+  const char *p = skip_ws(text, end);
+
+  if (p < end && *p == '{') {
+    return json_find(p, end, key, key_len, val, val_len);
+  }
+  return kv_find(p, end, key, key_len, val, val_len);
+}  /* field_find */
+
+
+field_t *field_compile(const char *spec, char *err, size_t err_size) {
+  const char *op = spec + strcspn(spec, ":~<>");
+  const char *val;
+  char *num_end;
+  field_t *f;
+
+  if (*op == '\0' || op == spec) {
+    snprintf(err, err_size, "'%s': expected key:value, key~pattern, key>number or key<number", spec);
+    return NULL;
+  }
+
+  f = (field_t *)calloc(1, sizeof(field_t));  E(f == NULL);
+  f->key_len = (int)(op - spec);
+  f->key = (char *)malloc(f->key_len + 1);  E(f->key == NULL);
+  memcpy(f->key, spec, f->key_len);
+  f->key[f->key_len] = '\0';
+
+  val = op + 1;
+  if (*op == ':') {
+    f->op = FIELD_OP_EQ;
+  } else if (*op == '~') {
+    f->op = FIELD_OP_RE;
+  } else if (*val == '=') {
+    f->op = (*op == '>') ? FIELD_OP_GE : FIELD_OP_LE;
+    val++;
+  } else {
+    f->op = (*op == '>') ? FIELD_OP_GT : FIELD_OP_LT;
+  }
+  f->str = strdup(val);  E(f->str == NULL);
+  f->str_len = (int)strlen(val);
+
+  if (f->op == FIELD_OP_RE) {
+    f->re = re_compile(val);  E(f->re == NULL);
+  } else if (f->op != FIELD_OP_EQ) {
+    f->num = strtod(val, &num_end);
+    if (num_end == val || *num_end != '\0') {
+      snprintf(err, err_size, "'%s': '%s' is not a number", spec, val);
+      field_free(f);
+      return NULL;
+    }
+  }
+  return f;
+}  /* field_compile */
+
+
+void field_free(field_t *f) {
+  if (f->re != NULL) { re_free(f->re); }
+  free(f->key);
+  free(f->str);
+  free(f);
+}  /* field_free */
+
+
+int field_match(field_t *f, const char *text, int text_len) {
+  const char *val;
+  char num_buf[64];
+  char *num_end;
+  double num;
+  int val_len;
+
+  if (!field_find(text, text_len, f->key, f->key_len, &val, &val_len)) {
+    return 0;
+  }
+
+  switch (f->op) {
+    case FIELD_OP_EQ:
+      return val_len == f->str_len && memcmp(val, f->str, val_len) == 0;
+    case FIELD_OP_RE:
+      return re_matchn(f->re, val, val_len, NULL, NULL);
+    default:
+      /* strtod needs a terminated string. */
+      if (val_len == 0 || val_len >= (int)sizeof(num_buf)) { return 0; }
+      memcpy(num_buf, val, val_len);
+      num_buf[val_len] = '\0';
+      num = strtod(num_buf, &num_end);
+      if (num_end != num_buf + val_len) { return 0; }
+      switch (f->op) {
+        case FIELD_OP_GT: return num > f->num;
+        case FIELD_OP_GE: return num >= f->num;
+        case FIELD_OP_LT: return num < f->num;
+        default: return num <= f->num;
+      }
+  }
+}  /* field_match */
@@ -0,0 +1,64 @@
+/* field.h - Structured log field matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef FIELD_H
+#define FIELD_H
+
+#include <stddef.h>
+#include "re.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Comparisons (the operator in "key<op>value"). */
+#define FIELD_OP_EQ  1   /* key:value   - value is exactly this string. */
+#define FIELD_OP_RE  2   /* key~pattern - value matches this re pattern. */
+#define FIELD_OP_GT  3   /* key>number */
+#define FIELD_OP_GE  4   /* key>=number */
+#define FIELD_OP_LT  5   /* key<number */
+#define FIELD_OP_LE  6   /* key<=number */
+
+/* One mon_field condition. */
+typedef struct field_s {
+  char *key;
+  int key_len;
+  int op;
+  char *str;         /* FIELD_OP_EQ: the value (and FIELD_OP_RE: the pattern). */
+  int str_len;
+  double num;        /* Numeric ops. */
+  re_t *re;          /* FIELD_OP_RE. */
+} field_t;
+
+
+/* Compile "key<op>value" (see FIELD_OP_*).  Returns NULL with a message
+ * in err on error. */
+field_t *field_compile(const char *spec, char *err, size_t err_size);
+void field_free(field_t *f);
+/* Find key's value in a log line that is either a JSON object (starts
+ * with '{'; top-level keys only) or key=value pairs.  Only the line up
+ * to the key is scanned, and only as far as needed to skip strings and
+ * nesting.  Sets *val and *val_len to the value (a string's contents, not
+ * unescaped) and returns 1, or returns 0 if the key isn't there or its
+ * value is an object or array. */
+int field_find(const char *text, int text_len, const char *key, int key_len,
+    const char **val, int *val_len);
+/* Returns 1 if the line has the field and its value satisfies f. */
+int field_match(field_t *f, const char *text, int text_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIELD_H */
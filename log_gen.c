@@ -0,0 +1,157 @@
+/* log_gen.c - Write a synthetic log file, for benchmarks (see bench.sh).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+/* Each line has a timestamp, a level, a worker and a message
+ * "request id=<n> took <ms> ms status=<code>", padded with lowercase
+ * words to its length.  A fraction of the lines (the density) are hits:
+ * level ERROR, 500 to 999 ms and status 503; the others are INFO, DEBUG
+ * or WARN, under 500 ms and status 200 or 404, so patterns on those
+ * fields match just the hits.  The output depends only on the options
+ * (its own random generator), so it is the same on every machine. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+#define MAX_LINE (16 * 1024 * 1024)
+
+uint64_t rng_state;
+
+
+/* xorshift64*. */
+static uint64_t rng(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}  /* rng */
+
+
+/* Uniform in [lo, hi]. */
+static int rng_range(int lo, int hi) {
+  return lo + (int)(rng() % (uint64_t)(hi - lo + 1));
+}  /* rng_range */
+
+
+/* 1 with probability p. */
+static int rng_chance(double p) {
+  return (double)(rng() >> 11) / 9007199254740992.0 < p;
+}  /* rng_chance */
+
+
+static void usage(void) {
+  fprintf(stderr,
+      "Usage: log_gen [-n lines] [-l min-max] [-t pct:len] [-d density] [-j] [-s seed] [-o file]\n"
+      "  -n lines    lines to write (default 200000)\n"
+      "  -l min-max  line length, uniform in [min, max] bytes (default 80-200)\n"
+      "  -t pct:len  also make pct percent of the lines len bytes long (a long tail)\n"
+      "  -d density  fraction of the lines that are hits (default 0.01)\n"
+      "  -j          JSON lines instead of plain text\n"
+      "  -s seed     random seed (default 1)\n"
+      "  -o file     write to file instead of stdout\n");
+  exit(1);
+}  /* usage */
+
+
+int main(int argc, char **argv) {
+  static const char *words[] = { "alpha", "bravo", "cache", "delta", "queue", "retry", "shard", "token" };
+  static const char *levels[] = { "INFO", "DEBUG", "WARN" };
+  FILE *out = stdout;
+  char *line;
+  int lines = 200000, min_len = 80, max_len = 200, json = 0;
+  double tail_pct = 0.0, density = 0.01;
+  int tail_len = 0;
+  int i, len, target, hit, ms, status, w;
+  const char *level;
+
+  rng_state = 1;
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0) {
+      json = 1;
+      continue;
+    }
+    if (i + 1 >= argc) { usage(); }
+    if (strcmp(argv[i], "-n") == 0) {
+      lines = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0) {
+      if (sscanf(argv[++i], "%d-%d", &min_len, &max_len) != 2) { usage(); }
+    } else if (strcmp(argv[i], "-t") == 0) {
+      if (sscanf(argv[++i], "%lf:%d", &tail_pct, &tail_len) != 2) { usage(); }
+    } else if (strcmp(argv[i], "-d") == 0) {
+      density = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0) {
+      rng_state = strtoull(argv[++i], NULL, 0);
+      if (rng_state == 0) { rng_state = 1; }  /* xorshift never leaves 0. */
+    } else if (strcmp(argv[i], "-o") == 0) {
+      out = fopen(argv[++i], "w");
+      if (out == NULL) { perror(argv[i]); exit(1); }
+    } else {
+      usage();
+    }
+  }
+  if (lines < 0 || min_len < 1 || max_len < min_len || max_len > MAX_LINE ||
+      tail_pct < 0.0 || tail_pct > 100.0 || tail_len < 0 || tail_len > MAX_LINE ||
+      density < 0.0 || density > 1.0) {
+    usage();
+  }
+
+  line = (char *)malloc(MAX_LINE + 256);  E(line == NULL);
+  for (i = 0; i < lines; i++) {
+    target = rng_chance(tail_pct / 100.0) ? tail_len : rng_range(min_len, max_len);
+    hit = rng_chance(density);
+    level = hit ? "ERROR" : levels[rng_range(0, 2)];
+    ms = hit ? rng_range(500, 999) : rng_range(0, 499);
+    status = hit ? 503 : (rng_chance(0.05) ? 404 : 200);
+    w = rng_range(0, 15);
+
+    if (json) {
+      len = sprintf(line, "{\"ts\":\"2024-05-01T12:%02d:%02d.%06d\",\"level\":\"%s\",\"worker\":%d,"
+          "\"msg\":\"request id=%d took %d ms status=%d\",\"pad\":\"",
+          (i / 60000) % 60, (i / 1000) % 60, i % 1000000, level, w, i, ms, status);
+      target -= 2;  /* For the closing "}. */
+    } else {
+      len = sprintf(line, "2024-05-01T12:%02d:%02d.%06d %-5s [worker-%d] request id=%d took %d ms status=%d",
+          (i / 60000) % 60, (i / 1000) % 60, i % 1000000, level, w, i, ms, status);
+    }
+    /* Pad with words (no digits or capitals, so patterns can't match them). */
+    if (len < target) {
+      line[len++] = ' ';
+    }
+    while (len < target) {
+      const char *word = words[rng() % 8];
+      int n = (int)strlen(word);
+      if (n > target - len) { n = target - len; }
+      memcpy(line + len, word, n);
+      len += n;
+      if (len < target) { line[len++] = ' '; }
+    }
+    if (json) {
+      line[len++] = '"';
+      line[len++] = '}';
+    }
+    line[len++] = '\n';
+    E(fwrite(line, 1, len, out) != (size_t)len);
+  }
+
+  free(line);
+  if (out != stdout) { E(fclose(out) != 0); }
+  return 0;
+}  /* main */
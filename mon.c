@@ -0,0 +1,250 @@
+/* mon.c - Log file scanning for dual_cap: split what was read into lines,
+ *   match them, and count mon_rate matches.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "mon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+/* With mon_workers, a read of at least this much is matched in parallel;
+ * below two batches, handing it over costs more than it saves. */
+#define MON_POOL_MIN (2 * MWORK_BATCH_SIZE)
+
+
+/* Count a match of a mon_rate pattern at now_ns.  Returns 1 if that
+ * makes count in the window, and then starts counting afresh. */
+static int mon_rate_add(mon_rate_t *rate, uint64_t now_ns) {
+  uint64_t b = now_ns / rate->bucket_ns;
+  int i;
+
+  if (b >= rate->head + RATE_BUCKETS) {
+    /* Everything counted has left the window. */
+    memset(rate->buckets, 0, sizeof(rate->buckets));
+    rate->total = 0;
+    rate->head = b;
+  }
+  while (rate->head < b) {  /* At most RATE_BUCKETS steps. */
+    rate->head++;
+    rate->total -= rate->buckets[rate->head % RATE_BUCKETS];
+    rate->buckets[rate->head % RATE_BUCKETS] = 0;
+  }
+  rate->buckets[rate->head % RATE_BUCKETS]++;
+  rate->total++;
+  if (rate->total < rate->count) { return 0; }
+
+  /* Fired.  Note the rate it saw, for the report. */
+  for (i = RATE_BUCKETS - 1; i > 0; i--) {
+    if (rate->buckets[(rate->head - i) % RATE_BUCKETS] != 0) { break; }
+  }
+  rate->fired_total = rate->total;
+  rate->fired_span_ns = now_ns - (rate->head - i) * rate->bucket_ns;
+  memset(rate->buckets, 0, sizeof(rate->buckets));
+  rate->total = 0;
+  return 1;
+}  /* mon_rate_add */
+
+
+void mon_rate_set(mpat_t *pats, int pat_idx, int count, int window_ms) {
+  mon_rate_t *rate = (mon_rate_t *)calloc(1, sizeof(mon_rate_t));  E(rate == NULL);
+
+  rate->count = count;
+  rate->window_ms = window_ms;
+  rate->bucket_ns = (uint64_t)window_ms * 1000000 / RATE_BUCKETS;
+  pats->pat_data[pat_idx] = rate;
+}  /* mon_rate_set */
+
+
+const char *mon_pat_kind(mpat_t *pats, int pat_idx) {
+  return (pats->fields[pat_idx] != NULL) ? "mon_field" : "mon_pattern";
+}  /* mon_pat_kind */
+
+
+/* Pattern pat_idx matched a line.  Returns 1 if that should trigger; a
+ * mon_rate pattern's match only counts toward its rate. */
+static int mon_pat_fired(mon_scanner_t *ms, mon_file_t *mf, int pat_idx) {
+  mon_rate_t *rate = (mon_rate_t *)mf->patterns->pat_data[pat_idx];
+
+  if (rate == NULL) {
+    fprintf(stderr, "INFO: mon_file '%s' %s %d '%s' matched\n", mf->path,
+        mon_pat_kind(mf->patterns, pat_idx), pat_idx + 1, mf->patterns->pat_strs[pat_idx]);
+    return 1;
+  }
+  if (mon_rate_add(rate, ms->observed_ns)) {
+    fprintf(stderr, "INFO: mon_file '%s' %s %d '%s' mon_rate %d/%d ms reached: %d in %.1f ms\n", mf->path,
+        mon_pat_kind(mf->patterns, pat_idx), pat_idx + 1, mf->patterns->pat_strs[pat_idx], rate->count, rate->window_ms,
+        rate->fired_total, (double)rate->fired_span_ns / 1000000.0);
+    return 1;
+  }
+  return 0;
+}  /* mon_pat_fired */
+
+
+/* Returns 1 if the line (without its newline) should trigger, setting
+ * *pat_idx to the pattern that fired (-1 if any line triggers). */
+static int mon_line_match(mon_scanner_t *ms, mon_file_t *mf, const char *line, size_t line_len, int *pat_idx) {
+  mf->lines++;
+  *pat_idx = -1;
+  if (mf->patterns == NULL) {
+    return 1;  /* Any line triggers. */
+  }
+
+  /* Strip trailing cr for pattern matching. */
+  while (line_len > 0 && line[line_len - 1] == '\r') {
+    line_len--;
+  }
+  /* If one that fires doesn't trigger, the patterns after it get their
+   * turn. */
+  *pat_idx = mpat_match(mf->patterns, line, (int)line_len);
+  while (*pat_idx >= 0) {
+    if (mon_pat_fired(ms, mf, *pat_idx)) { return 1; }
+    *pat_idx = mpat_next(mf->patterns, line, (int)line_len, *pat_idx);
+  }
+  return 0;
+}  /* mon_line_match */
+
+
+/* Feed the next piece of a line longer than the buffer to the file's
+ * stream; last: the piece ends the line (newline excluded).  Returns 1
+ * if the line should trigger, as mon_line_match. */
+static int mon_long_line_feed(mon_scanner_t *ms, mon_file_t *mf, const char *piece, size_t piece_len, int last, int *pat_idx) {
+  mpat_t *pats = mf->patterns;
+
+  if (!mf->in_long_line) {
+    if (mf->stream == NULL) {
+      mf->stream = mpat_stream_create(pats);  /* Once per file. */
+    }
+    mpat_stream_start(pats, mf->stream);
+    mf->in_long_line = 1;
+  }
+  if (last) {
+    while (piece_len > 0 && piece[piece_len - 1] == '\r') {
+      piece_len--;
+    }
+  }
+  mpat_stream_feed(pats, mf->stream, piece, (int)piece_len, last);
+  if (!last) { return 0; }
+
+  mf->in_long_line = 0;
+  mf->lines++;
+  mf->long_lines++;
+  *pat_idx = mpat_stream_next(pats, mf->stream, -1);
+  while (*pat_idx >= 0) {
+    if (mon_pat_fired(ms, mf, *pat_idx)) { return 1; }
+    *pat_idx = mpat_stream_next(pats, mf->stream, *pat_idx);
+  }
+  return 0;
+}  /* mon_long_line_feed */
+
+
+/* Match the complete lines in [p, end) with the mon_workers, if there
+ * are enough of them to be worth it.  Matches are handled in file order,
+ * as mon_line_match would, so the same line triggers as without workers.
+ * Returns where to go on matching from (in this thread). */
+static const char *mon_scan_pool(mon_scanner_t *ms, mon_file_t *mf, const char *p, const char *end) {
+  const char *lines_end = end;
+  mwork_hit_t *hits;
+  int num_hits, lines, matched, i;
+
+  while (lines_end > p && lines_end[-1] != '\n') {
+    lines_end--;
+  }
+  if (lines_end - p < MON_POOL_MIN) {
+    return p;
+  }
+
+  matched = mwork_match(ms->pool, mf->patterns, p, (int)(lines_end - p), &hits, &num_hits, &lines);
+  for (i = 0; i < num_hits; i++) {
+    if (mon_pat_fired(ms, mf, hits[i].pat_idx)) {
+      mf->lines += hits[i].line_num + 1;
+      ms->trigger(mf, hits[i].pat_idx);
+      return p + hits[i].off + hits[i].len + 1;
+    }
+  }
+  mf->lines += lines;
+  return p + matched;
+}  /* mon_scan_pool */
+
+
+/* An incomplete last line that fills the whole buffer is streamed (see
+ * mon_long_line_feed). */
+size_t mon_scan(mon_scanner_t *ms, mon_file_t *mf, const char *buf, size_t buf_len) {
+  const char *p = buf;
+  const char *end = buf + buf_len;
+  const char *nl;
+  size_t piece_len;
+  int pat_idx;
+
+  if (!*ms->stop && mf->in_long_line) {
+    /* buf continues a line longer than the buffer. */
+    nl = (const char *)memchr(p, '\n', buf_len);
+    if (nl == NULL) {
+      /* Hold back trailing cr's in case the newline comes next. */
+      piece_len = buf_len;
+      while (piece_len > 0 && buf[piece_len - 1] == '\r') {
+        piece_len--;
+      }
+      if (piece_len == 0 && buf_len == MON_BUF_SIZE) {
+        piece_len = buf_len;
+      }
+      mon_long_line_feed(ms, mf, buf, piece_len, 0, &pat_idx);
+      return piece_len;
+    }
+    if (mon_long_line_feed(ms, mf, buf, nl - buf, 1, &pat_idx)) {
+      ms->trigger(mf, pat_idx);
+    }
+    p = nl + 1;
+  }
+
+  if (!*ms->stop && ms->pool != NULL && mf->patterns != NULL) {
+    p = mon_scan_pool(ms, mf, p, end);
+  }
+
+  while (!*ms->stop && (nl = (const char *)memchr(p, '\n', end - p)) != NULL) {
+    if (mon_line_match(ms, mf, p, nl - p, &pat_idx)) {
+      ms->trigger(mf, pat_idx);
+    }
+    p = nl + 1;
+  }
+
+  if (!*ms->stop && p == buf && buf_len == MON_BUF_SIZE) {
+    /* Line longer than the buffer. */
+    if (mf->patterns == NULL) {
+      if (mon_line_match(ms, mf, buf, buf_len, &pat_idx)) {  /* Any line triggers. */
+        ms->trigger(mf, pat_idx);
+      }
+    } else {
+      mon_long_line_feed(ms, mf, buf, buf_len, 0, &pat_idx);
+    }
+    p = end;
+  }
+
+  return p - buf;
+}  /* mon_scan */
+
+
+void mon_pats_free(mpat_t *pats) {
+  int i;
+
+  for (i = 0; i < pats->num_pats; i++) {
+    free(pats->pat_data[i]);
+  }
+  mpat_free(pats);
+}  /* mon_pats_free */
@@ -0,0 +1,94 @@
+/* mon.h - Log file scanning for dual_cap: split what was read into lines,
+ *   match them, and count mon_rate matches.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef MON_H
+#define MON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "mpat.h"
+#include "mwork.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Log file read buffer.  Lines longer than this are streamed through the
+ * matcher a buffer at a time (see mon_scan). */
+#define MON_BUF_SIZE (1024 * 1024)
+
+/* mon_rate: the window is kept as this many buckets, so the count is
+ * exact to within one bucket (window / RATE_BUCKETS) of window. */
+#define RATE_BUCKETS 32
+
+/* A mon_rate rule (the pattern's mpat pat_data): trigger on count
+ * matches within window_ms.  Matches are counted in a ring of buckets
+ * by the time the data was read, so counting is constant time. */
+typedef struct mon_rate_s {
+  int count;
+  int window_ms;
+  uint64_t bucket_ns;  /* window_ms / RATE_BUCKETS. */
+  uint64_t head;       /* Bucket number (time / bucket_ns) of the newest. */
+  int total;           /* Matches in all buckets. */
+  int buckets[RATE_BUCKETS];
+  int fired_total;     /* When it last fired: matches in the window, */
+  uint64_t fired_span_ns;  /* and from the oldest one's bucket to then. */
+} mon_rate_t;
+
+/* One monitored log file (a mon_file spec expands to one or more). */
+typedef struct mon_file_s {
+  char *path;
+  FILE *fp;
+  mpat_t *patterns;  /* NULL: any line triggers.  May be shared. */
+  char *carry;       /* Incomplete last line, kept between reads. */
+  size_t carry_len;
+  size_t carry_size;
+  mpat_stream_t *stream;  /* Matcher state for a line longer than the buffer. */
+  int in_long_line;  /* stream holds the start of the current line. */
+  uint64_t long_lines;  /* Lines longer than the buffer. */
+  uint64_t bytes;    /* Bytes read since monitoring started. */
+  uint64_t lines;    /* Complete lines scanned. */
+} mon_file_t;
+
+/* A line of mf triggered: pat_idx is the pattern that fired (-1 if any
+ * line triggers). */
+typedef void (*mon_trigger_cb_t)(mon_file_t *mf, int pat_idx);
+
+/* What the scan shares between files. */
+typedef struct mon_scanner_s {
+  mwork_t *pool;          /* mon_workers (NULL if none). */
+  volatile int *stop;     /* Scanning stops once *stop is set. */
+  mon_trigger_cb_t trigger;  /* Called on a trigger; should set *stop. */
+  uint64_t observed_ns;   /* When the data being scanned was read. */
+} mon_scanner_t;
+
+
+/* Make pattern pat_idx of pats a mon_rate rule. */
+void mon_rate_set(mpat_t *pats, int pat_idx, int count, int window_ms);
+/* The config key that added pattern pat_idx. */
+const char *mon_pat_kind(mpat_t *pats, int pat_idx);
+/* Split buf into lines and match each in place (no copy).  Returns the
+ * number of bytes consumed; an incomplete last line is left unconsumed
+ * unless it fills the whole buffer (MON_BUF_SIZE), in which case it is
+ * streamed, so memory stays bounded however long it gets. */
+size_t mon_scan(mon_scanner_t *ms, mon_file_t *mf, const char *buf, size_t buf_len);
+/* Free a pattern set and its mon_rate rules. */
+void mon_pats_free(mpat_t *pats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MON_H */
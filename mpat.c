@@ -0,0 +1,375 @@
+/* mpat.c - Multi-pattern matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "mpat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+
+mpat_t *mpat_create(void) {
+  mpat_t *mp = (mpat_t *)calloc(1, sizeof(mpat_t));  E(mp == NULL);
+  return mp;
+}  /* mpat_create */
+
+
+void mpat_free(mpat_t *mp) {
+  int i;
+
+  for (i = 0; i < mp->num_pats; i++) {
+    if (mp->pats[i] != NULL) { re_free(mp->pats[i]); }
+    if (mp->fields[i] != NULL) { field_free(mp->fields[i]); }
+    free(mp->pat_strs[i]);
+  }
+  free(mp->pats);
+  free(mp->fields);
+  free(mp->pat_strs);
+  free(mp->pat_data);
+  free(mp->go);
+  free(mp->out_start);
+  free(mp->out_cnt);
+  free(mp->out_ids);
+  free(mp->cand_mark);
+  free(mp);
+}  /* mpat_free */
+
+
+/* Make room for one more pattern and clear its slot; returns its index. */
+static int mpat_new(mpat_t *mp, const char *pattern) {
+  int i = mp->num_pats;
+
+  if (i == mp->max_pats) {
+    mp->max_pats = (mp->max_pats == 0) ? 8 : mp->max_pats * 2;
+    mp->pats = (re_t **)realloc(mp->pats, mp->max_pats * sizeof(re_t *));  E(mp->pats == NULL);
+    mp->fields = (field_t **)realloc(mp->fields, mp->max_pats * sizeof(field_t *));  E(mp->fields == NULL);
+    mp->pat_strs = (char **)realloc(mp->pat_strs, mp->max_pats * sizeof(char *));  E(mp->pat_strs == NULL);
+    mp->pat_data = (void **)realloc(mp->pat_data, mp->max_pats * sizeof(void *));  E(mp->pat_data == NULL);
+  }
+
+  mp->pat_strs[i] = strdup(pattern);  E(mp->pat_strs[i] == NULL);
+  mp->pats[i] = NULL;
+  mp->fields[i] = NULL;
+  mp->pat_data[i] = NULL;
+  return i;
+}  /* mpat_new */
+
+
+int mpat_add(mpat_t *mp, const char *pattern) {
+  int i = mpat_new(mp, pattern);
+
+  mp->pats[i] = re_compile(pattern);  E(mp->pats[i] == NULL);
+
+  return mp->num_pats++;
+}  /* mpat_add */
+
+
+int mpat_add_field(mpat_t *mp, const char *spec, char *err, size_t err_size) {
+  field_t *f = field_compile(spec, err, err_size);
+  int i;
+
+  if (f == NULL) { return -1; }
+  i = mpat_new(mp, spec);
+  mp->fields[i] = f;
+
+  return mp->num_pats++;
+}  /* mpat_add_field */
+
+
+void mpat_set_engine(mpat_t *mp, int engine) {
+  int i;
+
+  mp->engine = engine;
+  for (i = 0; i < mp->num_pats; i++) {
+    if (mp->pats[i] != NULL) { re_set_engine(mp->pats[i], engine); }
+    if (mp->fields[i] != NULL && mp->fields[i]->re != NULL) { re_set_engine(mp->fields[i]->re, engine); }
+  }
+}  /* mpat_set_engine */
+
+
+/* The literal every line matching pattern i must contain (length 0 if
+ * none).  A field's value is matched as is (not unescaped), so its exact
+ * value, or its pattern's literal, is in the line too. */
+static const char *mpat_lit(mpat_t *mp, int i, int *lit_len) {
+  field_t *f = mp->fields[i];
+
+  if (f == NULL) {
+    *lit_len = mp->pats[i]->lit_len;
+    return mp->pats[i]->lit;
+  }
+  if (f->op == FIELD_OP_EQ && f->str_len > f->key_len) {
+    *lit_len = f->str_len;
+    return f->str;
+  }
+  if (f->op == FIELD_OP_RE && f->re->lit_len > f->key_len) {
+    *lit_len = f->re->lit_len;
+    return f->re->lit;
+  }
+  *lit_len = f->key_len;
+  return f->key;
+}  /* mpat_lit */
+
+
+static int mpat_matchn(mpat_t *mp, int i, const char *text, int text_len) {
+  if (mp->fields[i] != NULL) {
+    return field_match(mp->fields[i], text, text_len);
+  }
+  return re_matchn(mp->pats[i], text, text_len, NULL, NULL);
+}  /* mpat_matchn */
+
+
+void mpat_build(mpat_t *mp) {
+  int max_states = 1;
+  int *fail, *queue, *own_next, *own_head;
+  const char *lit;
+  int q_head, q_tail;
+  int i, k, c, s, n_out, lit_len;
+
+  /* Columns: one per distinct byte used in any literal, plus column 0
+   * for every other byte (which always leads back toward the root). */
+  memset(mp->byte_cls, 0, sizeof(mp->byte_cls));
+  mp->num_cls = 1;
+  for (i = 0; i < mp->num_pats; i++) {
+    lit = mpat_lit(mp, i, &lit_len);
+    for (k = 0; k < lit_len; k++) {
+      unsigned char b = (unsigned char)lit[k];
+      if (mp->byte_cls[b] == 0) {
+        E(mp->num_cls > 255);
+        mp->byte_cls[b] = (unsigned char)mp->num_cls++;
+      }
+    }
+    max_states += lit_len;
+  }
+
+  mp->go = (int *)malloc(max_states * mp->num_cls * sizeof(int));  E(mp->go == NULL);
+  for (i = 0; i < max_states * mp->num_cls; i++) { mp->go[i] = -1; }
+  fail = (int *)calloc(max_states, sizeof(int));  E(fail == NULL);
+  queue = (int *)malloc(max_states * sizeof(int));  E(queue == NULL);
+  own_head = (int *)malloc(max_states * sizeof(int));  E(own_head == NULL);
+  own_next = (int *)malloc((mp->num_pats + 1) * sizeof(int));  E(own_next == NULL);
+  for (i = 0; i < max_states; i++) { own_head[i] = -1; }
+
+  /* Trie of the literals. */
+  mp->num_states = 1;
+  for (i = 0; i < mp->num_pats; i++) {
+    lit = mpat_lit(mp, i, &lit_len);
+    if (lit_len == 0) { continue; }
+    s = 0;
+    for (k = 0; k < lit_len; k++) {
+      int *next = &mp->go[s * mp->num_cls + mp->byte_cls[(unsigned char)lit[k]]];
+      if (*next == -1) { *next = mp->num_states++; }
+      s = *next;
+    }
+    own_next[i] = own_head[s];
+    own_head[s] = i;
+  }
+
+  /* Breadth-first: set failure links and fill in missing transitions
+   * so the automaton is a DFA (one table lookup per byte). */
+  q_head = q_tail = 0;
+  for (c = 0; c < mp->num_cls; c++) {
+    int t = mp->go[c];
+    if (t == -1) {
+      mp->go[c] = 0;
+    } else {
+      fail[t] = 0;
+      queue[q_tail++] = t;
+    }
+  }
+  while (q_head < q_tail) {
+    s = queue[q_head++];
+    for (c = 0; c < mp->num_cls; c++) {
+      int t = mp->go[s * mp->num_cls + c];
+      int f = mp->go[fail[s] * mp->num_cls + c];
+      if (t == -1) {
+        mp->go[s * mp->num_cls + c] = f;
+      } else {
+        fail[t] = f;
+        queue[q_tail++] = t;
+      }
+    }
+  }
+
+  /* Outputs: literals ending at a state, plus those of its failure chain.
+   * States are numbered so that BFS order visits fail[s] before s. */
+  mp->out_start = (int *)malloc(mp->num_states * sizeof(int));  E(mp->out_start == NULL);
+  mp->out_cnt = (int *)calloc(mp->num_states, sizeof(int));  E(mp->out_cnt == NULL);
+  n_out = 0;
+  for (i = 0; i < q_tail; i++) {
+    s = queue[i];
+    for (k = own_head[s]; k != -1; k = own_next[k]) { mp->out_cnt[s]++; }
+    mp->out_cnt[s] += mp->out_cnt[fail[s]];
+    n_out += mp->out_cnt[s];
+  }
+  mp->out_ids = (int *)malloc((n_out + 1) * sizeof(int));  E(mp->out_ids == NULL);
+  n_out = 0;
+  mp->out_start[0] = 0;
+  for (i = 0; i < q_tail; i++) {
+    s = queue[i];
+    mp->out_start[s] = n_out;
+    for (k = own_head[s]; k != -1; k = own_next[k]) { mp->out_ids[n_out++] = k; }
+    for (k = 0; k < mp->out_cnt[fail[s]]; k++) {
+      mp->out_ids[n_out++] = mp->out_ids[mp->out_start[fail[s]] + k];
+    }
+  }
+
+  mp->cand_mark = (unsigned int *)calloc(mp->num_pats + 1, sizeof(unsigned int));  E(mp->cand_mark == NULL);
+  mp->cand_gen = 0;
+
+  free(fail);
+  free(queue);
+  free(own_head);
+  free(own_next);
+}  /* mpat_build */
+
+
+mpat_t *mpat_clone(const mpat_t *mp) {
+  mpat_t *cp = mpat_create();
+  char err[256];
+  int i;
+
+  for (i = 0; i < mp->num_pats; i++) {
+    if (mp->fields[i] != NULL) {
+      E(mpat_add_field(cp, mp->pat_strs[i], err, sizeof(err)) < 0);
+    } else {
+      mpat_add(cp, mp->pat_strs[i]);
+    }
+    cp->pat_data[i] = mp->pat_data[i];
+  }
+  mpat_set_engine(cp, mp->engine);
+  mpat_build(cp);
+  return cp;
+}  /* mpat_clone */
+
+
+int mpat_match(mpat_t *mp, const char *text, int text_len) {
+  const unsigned char *p = (const unsigned char *)text;
+  const unsigned char *end = p + text_len;
+  const int *go = mp->go;
+  int num_cls = mp->num_cls;
+  int s = 0;
+  int k;
+
+  if (mp->num_pats == 1) {
+    /* re_matchn's own literal search beats the automaton for one pattern
+     * (and a field is found by scanning the line anyway). */
+    return mpat_matchn(mp, 0, text, text_len) ? 0 : -1;
+  }
+
+  mp->cand_gen++;
+  if (mp->cand_gen == 0) {
+    /* Wrapped; old marks could alias the new generation. */
+    memset(mp->cand_mark, 0, mp->num_pats * sizeof(unsigned int));
+    mp->cand_gen = 1;
+  }
+
+  while (p < end) {
+    s = go[s * num_cls + mp->byte_cls[*p++]];
+    for (k = 0; k < mp->out_cnt[s]; k++) {
+      mp->cand_mark[mp->out_ids[mp->out_start[s] + k]] = mp->cand_gen;
+    }
+  }
+
+  return mpat_next(mp, text, text_len, -1);
+}  /* mpat_match */
+
+
+int mpat_next(mpat_t *mp, const char *text, int text_len, int after) {
+  int i, lit_len;
+
+  /* Confirm candidates in pattern order.  (With one pattern there are no
+   * candidate marks; mpat_match already ran it.) */
+  for (i = after + 1; i < mp->num_pats; i++) {
+    mpat_lit(mp, i, &lit_len);
+    if (lit_len > 0 && mp->cand_mark[i] != mp->cand_gen) { continue; }
+    if (mpat_matchn(mp, i, text, text_len)) {
+      return i;
+    }
+  }
+
+  return -1;
+}  /* mpat_next */
+
+
+mpat_stream_t *mpat_stream_create(mpat_t *mp) {
+  mpat_stream_t *ms = (mpat_stream_t *)calloc(1, sizeof(mpat_stream_t));  E(ms == NULL);
+  int i;
+
+  ms->num_pats = mp->num_pats;
+  ms->rs = (re_stream_t **)calloc(mp->num_pats, sizeof(re_stream_t *));  E(ms->rs == NULL);
+  ms->hit = (char *)calloc(mp->num_pats, 1);  E(ms->hit == NULL);
+  for (i = 0; i < mp->num_pats; i++) {
+    if (mp->pats[i] != NULL) {
+      ms->rs[i] = re_stream_create(mp->pats[i]);
+    }
+  }
+  return ms;
+}  /* mpat_stream_create */
+
+
+void mpat_stream_free(mpat_stream_t *ms) {
+  int i;
+
+  for (i = 0; i < ms->num_pats; i++) {
+    if (ms->rs[i] != NULL) { re_stream_free(ms->rs[i]); }
+  }
+  free(ms->rs);
+  free(ms->hit);
+  free(ms);
+}  /* mpat_stream_free */
+
+
+void mpat_stream_start(mpat_t *mp, mpat_stream_t *ms) {
+  int i;
+
+  for (i = 0; i < mp->num_pats; i++) {
+    ms->hit[i] = 0;
+    if (ms->rs[i] != NULL) {
+      re_stream_start(mp->pats[i], ms->rs[i]);
+    }
+  }
+  ms->started = 0;
+}  /* mpat_stream_start */
+
+
+void mpat_stream_feed(mpat_t *mp, mpat_stream_t *ms, const char *text, int text_len, int last) {
+  int i;
+
+  for (i = 0; i < mp->num_pats; i++) {
+    if (ms->hit[i]) { continue; }
+    if (ms->rs[i] != NULL) {
+      ms->hit[i] = (char)re_stream_feed(mp->pats[i], ms->rs[i], text, text_len, last);
+    } else if (!ms->started) {
+      ms->hit[i] = (char)field_match(mp->fields[i], text, text_len);
+    }
+  }
+  ms->started = 1;
+}  /* mpat_stream_feed */
+
+
+int mpat_stream_next(mpat_t *mp, mpat_stream_t *ms, int after) {
+  int i;
+
+  for (i = after + 1; i < mp->num_pats; i++) {
+    if (ms->hit[i]) {
+      return i;
+    }
+  }
+  return -1;
+}  /* mpat_stream_next */
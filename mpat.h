@@ -0,0 +1,100 @@
+/* mpat.h - Multi-pattern matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef MPAT_H
+#define MPAT_H
+
+#include "re.h"
+#include "field.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* A set of patterns.  The required literal of each pattern (see re_t.lit)
+ * is compiled into one Aho-Corasick automaton, so a line is scanned once
+ * no matter how many patterns there are; re_matchn only runs for
+ * patterns whose literal was seen (or that have no literal).  A pattern
+ * may instead be a field condition (see field.h), whose literal is the
+ * longer of its key and the text its value must contain. */
+typedef struct mpat_s {
+  int num_pats;
+  int max_pats;
+  char **pat_strs;             /* Pattern source strings (owned). */
+  re_t **pats;                 /* Compiled patterns (NULL for a field condition). */
+  field_t **fields;            /* Field conditions (NULL for a pattern). */
+  void **pat_data;             /* Caller's data per pattern (NULL unless set; not freed). */
+  int engine;                  /* As last given to mpat_set_engine. */
+
+  /* Aho-Corasick DFA, valid after mpat_build(). */
+  unsigned char byte_cls[256]; /* Byte -> column; 0 = not in any literal. */
+  int num_cls;
+  int num_states;
+  int *go;                     /* num_states x num_cls next-state table. */
+  int *out_start;              /* Per state: index into out_ids. */
+  int *out_cnt;                /* Per state: number of literals ending here. */
+  int *out_ids;                /* Pattern indexes, grouped by state. */
+
+  unsigned int *cand_mark;     /* Per pattern: line generation it was a candidate in. */
+  unsigned int cand_gen;
+} mpat_t;
+
+/* Streaming match state of one line (see mpat_stream_feed). */
+typedef struct mpat_stream_s {
+  int num_pats;
+  re_stream_t **rs;            /* Per pattern (NULL for a field condition). */
+  char *hit;                   /* Per pattern: matched so far. */
+  int started;                 /* The first piece has been fed. */
+} mpat_stream_t;
+
+
+mpat_t *mpat_create(void);
+void mpat_free(mpat_t *mp);
+/* Add a pattern; returns its index (patterns are numbered in order added). */
+int mpat_add(mpat_t *mp, const char *pattern);
+/* Add a field condition (see field_compile); numbered along with the
+ * patterns.  Returns its index, or -1 with a message in err. */
+int mpat_add_field(mpat_t *mp, const char *spec, char *err, size_t err_size);
+/* Set the engine for every pattern (see re_set_engine). */
+void mpat_set_engine(mpat_t *mp, int engine);
+/* Build the automaton; call after the last mpat_add. */
+void mpat_build(mpat_t *mp);
+/* A built copy of mp with its own scratch space, for matching in another
+ * thread (an mpat_t must only be used by one thread at a time).  The
+ * pat_data pointers are copied, not what they point to. */
+mpat_t *mpat_clone(const mpat_t *mp);
+/* Returns the lowest index of a pattern matching text, or -1 if none. */
+int mpat_match(mpat_t *mp, const char *text, int text_len);
+/* After mpat_match on the same text: returns the lowest index above
+ * after of a pattern matching it, or -1 if none. */
+int mpat_next(mpat_t *mp, const char *text, int text_len, int after);
+
+/* Streaming: match a line that arrives in pieces without keeping it (see
+ * re_stream_feed).  Create a stream once per source of lines (after
+ * mpat_build), then start it for each line and feed it the pieces.  The
+ * literal prefilter isn't used, since a literal may span pieces, and
+ * field conditions only look at the first piece. */
+mpat_stream_t *mpat_stream_create(mpat_t *mp);
+void mpat_stream_free(mpat_stream_t *ms);
+void mpat_stream_start(mpat_t *mp, mpat_stream_t *ms);
+void mpat_stream_feed(mpat_t *mp, mpat_stream_t *ms, const char *text, int text_len, int last);
+/* After the last piece: returns the lowest index above after of a
+ * pattern that matched the line, or -1 if none. */
+int mpat_stream_next(mpat_t *mp, mpat_stream_t *ms, int after);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MPAT_H */
@@ -0,0 +1,287 @@
+/* mwork.c - Parallel log line matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "mwork.h"
+#include "plat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* One batch of lines and what a worker found in it. */
+typedef struct mwork_batch_s {
+  int off;
+  int len;
+  int lines;         /* Lines matched. */
+  int bytes;         /* Bytes of them. */
+  int stop;          /* Where matching stopped short (final match or full hits), or -1. */
+  int num_hits;
+  mwork_hit_t hits[MWORK_BATCH_HITS];  /* line_num is within the batch. */
+} mwork_batch_t;
+
+typedef struct mwork_worker_s {
+  struct mwork_s *mw;
+  plat_thread_t thr;
+  int cpu;           /* Pin to this CPU (-1 = don't). */
+  mpat_t **orig;     /* Pattern sets seen, and this worker's copy of each. */
+  mpat_t **copy;
+  int num_copies;
+  mwork_stats_t stats;
+} mwork_worker_t;
+
+/* The batches of one mwork_match call form a lock-free queue: workers
+ * claim the next one by atomically incrementing next.  The "work"
+ * semaphore is posted once per batch, so a worker only sleeps when there
+ * is nothing left to claim, and every claim is for a batch of the
+ * current call.  The worker that finishes the last batch posts "done". */
+struct mwork_s {
+  int num_workers;
+  mwork_worker_t *workers;
+  mpat_t *mp;
+  const char *text;
+  mwork_batch_t batches[MWORK_MAX_BATCHES];
+  int num_batches;
+  volatile int next;       /* Next batch to claim. */
+  volatile int finished;   /* Batches finished. */
+  volatile int final_batch;  /* Hint: a batch with a final match. */
+  volatile int stop;       /* Tells the workers to exit. */
+  plat_sem_t work;
+  plat_sem_t done;
+  mwork_hit_t hits[MWORK_MAX_BATCHES * MWORK_BATCH_HITS];
+};
+
+
+/* This worker's copy of mp. */
+static mpat_t *mwork_copy(mwork_worker_t *w, mpat_t *mp) {
+  int i;
+
+  for (i = 0; i < w->num_copies; i++) {
+    if (w->orig[i] == mp) { return w->copy[i]; }
+  }
+  w->orig = (mpat_t **)realloc(w->orig, (i + 1) * sizeof(mpat_t *));  E(w->orig == NULL);
+  w->copy = (mpat_t **)realloc(w->copy, (i + 1) * sizeof(mpat_t *));  E(w->copy == NULL);
+  w->orig[i] = mp;
+  w->copy[i] = mpat_clone(mp);
+  w->num_copies++;
+  return w->copy[i];
+}  /* mwork_copy */
+
+
+static void mwork_batch(mwork_t *mw, mpat_t *mp, int b_idx) {
+  mwork_batch_t *b = &mw->batches[b_idx];
+  const char *p = mw->text + b->off;
+  const char *end = p + b->len;
+  const char *nl;
+  mwork_hit_t line_hits[MWORK_BATCH_HITS];
+  int n, len, i, final;
+
+  b->lines = 0;
+  b->bytes = 0;
+  b->stop = -1;
+  b->num_hits = 0;
+  while (p < end) {
+    if (mw->final_batch < b_idx) {
+      return;  /* An earlier batch has the result; this one doesn't matter. */
+    }
+    nl = (const char *)memchr(p, '\n', end - p);
+    len = (int)(nl - p);
+    while (len > 0 && p[len - 1] == '\r') {
+      len--;
+    }
+
+    /* Collect the line's matches, so it is either all in or not. */
+    n = 0;
+    final = 0;
+    i = mpat_match(mp, p, len);
+    while (i >= 0) {
+      if (b->num_hits + n == MWORK_BATCH_HITS) {
+        b->stop = (int)(p - mw->text);
+        return;
+      }
+      line_hits[n].off = (int)(p - mw->text);
+      line_hits[n].len = (int)(nl - p);
+      line_hits[n].line_num = b->lines;
+      line_hits[n].pat_idx = i;
+      n++;
+      if (mp->pat_data[i] == NULL) {
+        final = 1;
+        break;
+      }
+      i = mpat_next(mp, p, len, i);
+    }
+    memcpy(&b->hits[b->num_hits], line_hits, n * sizeof(mwork_hit_t));
+    b->num_hits += n;
+    b->lines++;
+    b->bytes += (int)(nl + 1 - p);
+    p = nl + 1;
+
+    if (final) {
+      b->stop = (int)(p - mw->text);
+      /* Racy, but only ever set to a batch that does have one. */
+      if (b_idx < mw->final_batch) { mw->final_batch = b_idx; }
+      return;
+    }
+  }
+}  /* mwork_batch */
+
+
+static void *mwork_thread(void *arg) {
+  mwork_worker_t *w = (mwork_worker_t *)arg;
+  mwork_t *mw = w->mw;
+  mwork_batch_t *b;
+  uint64_t start_ns;
+  int b_idx;
+
+  if (w->cpu >= 0) {
+    E(plat_thread_pin(w->cpu) != 0);
+  }
+
+  while (1) {
+    plat_sem_wait(&mw->work);
+    if (mw->stop) { break; }
+    b_idx = plat_fetch_add(&mw->next, 1);
+    b = &mw->batches[b_idx];
+
+    start_ns = plat_monotonic_ns();
+    mwork_batch(mw, mwork_copy(w, mw->mp), b_idx);
+    w->stats.busy_ns += plat_monotonic_ns() - start_ns;
+    w->stats.lines += b->lines;
+    w->stats.bytes += b->bytes;
+    w->stats.batches++;
+
+    if (plat_fetch_add(&mw->finished, 1) + 1 == mw->num_batches) {
+      plat_sem_post(&mw->done);
+    }
+  }
+
+  return NULL;
+}  /* mwork_thread */
+
+
+mwork_t *mwork_create(int num_workers, const int *cpus) {
+  mwork_t *mw = (mwork_t *)calloc(1, sizeof(mwork_t));  E(mw == NULL);
+  int i;
+
+  mw->num_workers = num_workers;
+  mw->workers = (mwork_worker_t *)calloc(num_workers, sizeof(mwork_worker_t));  E(mw->workers == NULL);
+  E(plat_sem_init(&mw->work, 0) != 0);
+  E(plat_sem_init(&mw->done, 0) != 0);
+  for (i = 0; i < num_workers; i++) {
+    mw->workers[i].mw = mw;
+    mw->workers[i].cpu = (cpus != NULL) ? cpus[i] : -1;
+    E(plat_thread_create(&mw->workers[i].thr, mwork_thread, &mw->workers[i]) != 0);
+  }
+  return mw;
+}  /* mwork_create */
+
+
+void mwork_close(mwork_t *mw) {
+  int i, j;
+
+  mw->stop = 1;
+  for (i = 0; i < mw->num_workers; i++) {
+    plat_sem_post(&mw->work);
+  }
+  for (i = 0; i < mw->num_workers; i++) {
+    plat_thread_join(mw->workers[i].thr);
+    for (j = 0; j < mw->workers[i].num_copies; j++) {
+      mpat_free(mw->workers[i].copy[j]);
+    }
+    free(mw->workers[i].orig);
+    free(mw->workers[i].copy);
+  }
+  plat_sem_destroy(&mw->work);
+  plat_sem_destroy(&mw->done);
+  free(mw->workers);
+  free(mw);
+}  /* mwork_close */
+
+
+int mwork_match(mwork_t *mw, mpat_t *mp, const char *text, int text_len,
+    mwork_hit_t **hits, int *num_hits, int *lines) {
+  int batch_size = text_len / MWORK_MAX_BATCHES + 1;
+  int off = 0, end, i, h, n = 0, line_base = 0, matched = text_len;
+  mwork_batch_t *b;
+
+  /* Split into whole lines; each batch but the last is at least
+   * batch_size, so there are at most MWORK_MAX_BATCHES. */
+  if (batch_size < MWORK_BATCH_SIZE) { batch_size = MWORK_BATCH_SIZE; }
+  while (off < text_len) {
+    end = off + batch_size;
+    if (end >= text_len) {
+      end = text_len;
+    } else {
+      end = (int)((const char *)memchr(text + end - 1, '\n', text_len - (end - 1)) - text) + 1;
+    }
+    mw->batches[n].off = off;
+    mw->batches[n].len = end - off;
+    n++;
+    off = end;
+  }
+
+  mw->mp = mp;
+  mw->text = text;
+  mw->num_batches = n;
+  mw->final_batch = n;
+  mw->finished = 0;
+  mw->next = 0;
+  for (i = 0; i < n; i++) {
+    plat_sem_post(&mw->work);  /* A barrier: the batches are set up. */
+  }
+  plat_sem_wait(&mw->done);
+
+  /* Merge in file order, up to the first batch that stopped short. */
+  *num_hits = 0;
+  for (i = 0; i < n; i++) {
+    b = &mw->batches[i];
+    for (h = 0; h < b->num_hits; h++) {
+      mw->hits[*num_hits] = b->hits[h];
+      mw->hits[*num_hits].line_num += line_base;
+      (*num_hits)++;
+    }
+    line_base += b->lines;
+    if (b->stop >= 0) {
+      matched = b->stop;
+      break;
+    }
+  }
+  *hits = mw->hits;
+  *lines = line_base;
+  return matched;
+}  /* mwork_match */
+
+
+int mwork_num_workers(mwork_t *mw) {
+  return mw->num_workers;
+}  /* mwork_num_workers */
+
+
+void mwork_stats(mwork_t *mw, int i, mwork_stats_t *stats) {
+  *stats = mw->workers[i].stats;
+}  /* mwork_stats */
+
+
+void mwork_reset_stats(mwork_t *mw) {
+  int i;
+
+  for (i = 0; i < mw->num_workers; i++) {
+    memset(&mw->workers[i].stats, 0, sizeof(mwork_stats_t));
+  }
+}  /* mwork_reset_stats */
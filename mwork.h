@@ -0,0 +1,73 @@
+/* mwork.h - Parallel log line matching for dual_cap.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#ifndef MWORK_H
+#define MWORK_H
+
+#include <stdint.h>
+#include "mpat.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Text is split into batches of about this many bytes (whole lines). */
+#define MWORK_BATCH_SIZE (64 * 1024)
+#define MWORK_MAX_BATCHES 64
+/* Matches one batch can hold; past that, the caller matches the rest. */
+#define MWORK_BATCH_HITS 64
+
+/* A line that matched a pattern. */
+typedef struct mwork_hit_s {
+  int off;           /* Line start, from the start of the text. */
+  int len;           /* Line length, without its newline. */
+  int line_num;      /* Lines before it in the text. */
+  int pat_idx;
+} mwork_hit_t;
+
+typedef struct mwork_stats_s {
+  uint64_t lines;
+  uint64_t bytes;
+  uint64_t batches;
+  uint64_t busy_ns;  /* Time spent matching (lines / busy_ns = rate). */
+} mwork_stats_t;
+
+typedef struct mwork_s mwork_t;
+
+
+/* Start num_workers threads; cpus, if not NULL, has the CPU to pin each
+ * one to. */
+mwork_t *mwork_create(int num_workers, const int *cpus);
+void mwork_close(mwork_t *mw);
+/* Match the lines of text (text_len bytes, ending with a newline) against
+ * mp, spread over the workers, and wait for them.  Each worker matches
+ * with its own copy of mp (see mpat_clone), made the first time it sees
+ * it.  Sets *hits to the matches, by line and then by pattern, as
+ * mpat_match and mpat_next would find them (valid until the next call).
+ * A match of a pattern without pat_data is final: lines after it are
+ * not looked at.  Returns how far the text was matched, which is short
+ * of text_len after a final match or if a batch had too many matches;
+ * *lines is the number of lines before that. */
+int mwork_match(mwork_t *mw, mpat_t *mp, const char *text, int text_len,
+    mwork_hit_t **hits, int *num_hits, int *lines);
+int mwork_num_workers(mwork_t *mw);
+/* Stats of worker i since it started or since the last mwork_reset_stats. */
+void mwork_stats(mwork_t *mw, int i, mwork_stats_t *stats);
+void mwork_reset_stats(mwork_t *mw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MWORK_H */
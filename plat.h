@@ -19,6 +19,7 @@
 #include <ws2tcpip.h>
 typedef SOCKET plat_sock_t;
 typedef HANDLE plat_thread_t;
+typedef HANDLE plat_sem_t;
 typedef struct {
   HANDLE hProcess;
   DWORD  dwProcessId;
@@ -31,12 +32,19 @@ typedef struct {
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
 typedef int plat_sock_t;
 typedef pthread_t plat_thread_t;
+/* A counting semaphore (unnamed POSIX semaphores are not on macOS). */
+typedef struct plat_sem_s {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int count;
+} plat_sem_t;
 typedef pid_t plat_proc_t;
 #define PLAT_INVALID_SOCK (-1)
 #endif
@@ -48,14 +56,50 @@ typedef pid_t plat_proc_t;
 
 typedef void *(*plat_thread_func_t)(void *);
 
+/* Opaque log file change monitor (inotify on Linux, polling elsewhere). */
+typedef struct plat_mon_s plat_mon_t;
+/* Opaque event loop (epoll on Linux; not available elsewhere). */
+typedef struct plat_evl_s plat_evl_t;
+#define PLAT_SIG_INT  0x1  /* Bits returned by plat_evl_signals(). */
+#define PLAT_SIG_CHLD 0x2
+typedef void (*plat_glob_cb_t)(const char *path, void *arg);
+
 int plat_init(void);
 void plat_sleep_ms(int ms);
+uint64_t plat_monotonic_ns(void);
+uint64_t plat_wall_ns(void);
+uint64_t plat_thread_cpu_ns(void);
 int plat_thread_create(plat_thread_t *thr, plat_thread_func_t func, void *arg);
 int plat_thread_join(plat_thread_t thr);
+int plat_thread_pin(int cpu);
+int plat_fetch_add(volatile int *p, int n);
+int plat_sem_init(plat_sem_t *sem, int count);
+void plat_sem_wait(plat_sem_t *sem);
+void plat_sem_post(plat_sem_t *sem);
+void plat_sem_destroy(plat_sem_t *sem);
 int plat_close_sock(plat_sock_t sock);
+int plat_connect_start(plat_sock_t sock, const struct sockaddr *addr, int addr_len);
+int plat_connect_check(plat_sock_t sock);
 int plat_spawn_cmd(const char *cmd, plat_proc_t *proc);
 int plat_kill_proc(plat_proc_t proc);
 int plat_wait_proc(plat_proc_t proc);
+int plat_proc_exited(plat_proc_t proc);
 void plat_install_ctrl_handler(plat_proc_t *proc_ptr, int *running_ptr);
+plat_mon_t *plat_mon_create(void);
+int plat_mon_add(plat_mon_t *mon, const char *path);
+int plat_mon_wait(plat_mon_t *mon, int timeout_ms, char *changed);
+void plat_mon_close(plat_mon_t *mon);
+int plat_glob(const char *pattern, plat_glob_cb_t cb, void *arg);
+int plat_mon_polling(plat_mon_t *mon);
+plat_evl_t *plat_evl_create(void);
+int plat_evl_add_sock(plat_evl_t *evl, plat_sock_t sock, int id);
+int plat_evl_del_sock(plat_evl_t *evl, plat_sock_t sock);
+int plat_evl_add_mon(plat_evl_t *evl, plat_mon_t *mon, int id);
+int plat_evl_add_wake(plat_evl_t *evl, int id);
+int plat_evl_add_signals(plat_evl_t *evl, int id);
+int plat_evl_wait(plat_evl_t *evl, int timeout_ms, int *ids, int max_ids);
+void plat_evl_wake(plat_evl_t *evl);
+int plat_evl_signals(plat_evl_t *evl);
+void plat_evl_close(plat_evl_t *evl);
 
 #endif  /* PLAT_H */
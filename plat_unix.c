@@ -11,7 +11,47 @@
  * Project home: https://github.com/fordsfords/dual_cap
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* For sched_setaffinity. */
+#endif
 #include "plat.h"
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <glob.h>
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#endif
+
+/* File monitor state.  inot_fd is -1 when inotify is unavailable (non-Linux,
+ * or inotify_init failed).  A file whose watch is -1 is polled: it is
+ * reported as changed on every plat_mon_wait(). */
+struct plat_mon_s {
+  int inot_fd;
+  int num_files;
+  int max_files;
+  int *wds;  /* Per file id: inotify watch descriptor, or -1. */
+};
+
+/* Event loop state.  The epoll data of each registration holds the
+ * caller's id in the low 32 bits and an EVL_KIND_* in the high bits, so
+ * plat_evl_wait() knows which internal descriptors to drain. */
+#define EVL_KIND_USER 0
+#define EVL_KIND_WAKE 1
+#define EVL_KIND_SIG  2
+struct plat_evl_s {
+  int ep_fd;
+  int wake_fd;  /* eventfd, or -1. */
+  int sig_fd;   /* signalfd for SIGINT/SIGCHLD, or -1. */
+  int sigs;     /* PLAT_SIG_* bits received, not yet returned. */
+};
 
 /* Ctrl handler state: set by plat_install_ctrl_handler. */
 static plat_proc_t *s_proc_ptr = NULL;
@@ -38,6 +78,29 @@ void plat_sleep_ms(int ms) {
 }  /* plat_sleep_ms */
 
 
+uint64_t plat_monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}  /* plat_monotonic_ns */
+
+
+/* Wall clock time (ns since 1970), as used in capture timestamps. */
+uint64_t plat_wall_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}  /* plat_wall_ns */
+
+
+/* CPU time used by the calling thread. */
+uint64_t plat_thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}  /* plat_thread_cpu_ns */
+
+
 int plat_thread_create(plat_thread_t *thr, plat_thread_func_t func, void *arg) {
   return pthread_create(thr, NULL, func, arg);
 }  /* plat_thread_create */
@@ -48,17 +111,111 @@ int plat_thread_join(plat_thread_t thr) {
 }  /* plat_thread_join */
 
 
+/* Pin the calling thread to one CPU.  Fails where there is no
+ * sched_setaffinity (non-Linux). */
+int plat_thread_pin(int cpu) {
+#ifdef __linux__
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  return sched_setaffinity(0, sizeof(cpus), &cpus);
+#else
+  (void)cpu;
+  return -1;
+#endif
+}  /* plat_thread_pin */
+
+
+/* Atomically add n to *p; returns the old value.  A full barrier. */
+int plat_fetch_add(volatile int *p, int n) {
+  return __sync_fetch_and_add(p, n);
+}  /* plat_fetch_add */
+
+
+int plat_sem_init(plat_sem_t *sem, int count) {
+  if (pthread_mutex_init(&sem->lock, NULL) != 0) { return -1; }
+  if (pthread_cond_init(&sem->cond, NULL) != 0) {
+    pthread_mutex_destroy(&sem->lock);
+    return -1;
+  }
+  sem->count = count;
+  return 0;
+}  /* plat_sem_init */
+
+
+void plat_sem_wait(plat_sem_t *sem) {
+  pthread_mutex_lock(&sem->lock);
+  while (sem->count == 0) {
+    pthread_cond_wait(&sem->cond, &sem->lock);
+  }
+  sem->count--;
+  pthread_mutex_unlock(&sem->lock);
+}  /* plat_sem_wait */
+
+
+void plat_sem_post(plat_sem_t *sem) {
+  pthread_mutex_lock(&sem->lock);
+  sem->count++;
+  pthread_cond_signal(&sem->cond);
+  pthread_mutex_unlock(&sem->lock);
+}  /* plat_sem_post */
+
+
+void plat_sem_destroy(plat_sem_t *sem) {
+  pthread_cond_destroy(&sem->cond);
+  pthread_mutex_destroy(&sem->lock);
+}  /* plat_sem_destroy */
+
+
 int plat_close_sock(plat_sock_t sock) {
   return close(sock);
 }  /* plat_close_sock */
 
 
+/* Start connecting without waiting.  Returns 0 if connected, 1 if in
+ * progress (see plat_connect_check), -1 if it failed. */
+int plat_connect_start(plat_sock_t sock, const struct sockaddr *addr, int addr_len) {
+  int flags = fcntl(sock, F_GETFL);
+
+  if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) != 0) { return -1; }
+  if (connect(sock, addr, (socklen_t)addr_len) == 0) {
+    fcntl(sock, F_SETFL, flags);
+    return 0;
+  }
+  return (errno == EINPROGRESS) ? 1 : -1;
+}  /* plat_connect_start */
+
+
+/* Check on a connect in progress (doesn't wait).  Returns 0 if it is now
+ * connected (and the socket blocking again), 1 if still in progress, -1
+ * if it failed. */
+int plat_connect_check(plat_sock_t sock) {
+  struct pollfd pfd;
+  socklen_t len = sizeof(int);
+  int err = 0;
+
+  pfd.fd = sock;
+  pfd.events = POLLOUT;
+  pfd.revents = 0;
+  if (poll(&pfd, 1, 0) <= 0) { return 1; }
+  if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) { return -1; }
+  fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+  return 0;
+}  /* plat_connect_check */
+
+
 int plat_spawn_cmd(const char *cmd, plat_proc_t *proc) {
   pid_t pid = fork();
   if (pid < 0) { return -1; }  /* fork failed. */
 
   if (pid == 0) {
-    /* Child: new process group so we can kill the whole tree. */
+    sigset_t none;
+    /* Child: undo any signals blocked for the event loop (the mask
+     * survives exec). */
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    /* New process group so we can kill the whole tree. */
     setpgid(0, 0);
     execlp("/bin/sh", "sh", "-c", cmd, (char *)NULL);
     _exit(127);  /* exec failed. */
@@ -85,8 +242,302 @@ int plat_wait_proc(plat_proc_t proc) {
 }  /* plat_wait_proc */
 
 
+/* Returns 1 (and reaps it) if the process has exited, else 0. */
+int plat_proc_exited(plat_proc_t proc) {
+  int status;
+  return (waitpid(proc, &status, WNOHANG) == proc);
+}  /* plat_proc_exited */
+
+
 void plat_install_ctrl_handler(plat_proc_t *proc_ptr, int *running_ptr) {
   s_proc_ptr = proc_ptr;
   s_running_ptr = running_ptr;
   signal(SIGINT, sigint_handler);
 }  /* plat_install_ctrl_handler */
+
+
+plat_mon_t *plat_mon_create(void) {
+  plat_mon_t *mon = (plat_mon_t *)calloc(1, sizeof(plat_mon_t));
+  if (mon == NULL) { return NULL; }
+
+  mon->inot_fd = -1;
+#ifdef __linux__
+  mon->inot_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+  return mon;
+}  /* plat_mon_create */
+
+
+/* Start watching path.  Returns its file id (0, 1, ...), or -1 on error. */
+int plat_mon_add(plat_mon_t *mon, const char *path) {
+  int wd = -1;
+
+  if (mon->num_files == mon->max_files) {
+    int *wds;
+    mon->max_files = (mon->max_files == 0) ? 8 : mon->max_files * 2;
+    wds = (int *)realloc(mon->wds, mon->max_files * sizeof(int));
+    if (wds == NULL) { return -1; }
+    mon->wds = wds;
+  }
+
+#ifdef __linux__
+  if (mon->inot_fd >= 0) {
+    wd = inotify_add_watch(mon->inot_fd, path,
+        IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+  }
+#else
+  (void)path;
+#endif
+
+  mon->wds[mon->num_files] = wd;
+  return mon->num_files++;
+}  /* plat_mon_add */
+
+
+/* Wait up to timeout_ms for files to change.  Sets changed[id] to 1 for
+ * each file that changed (or is polled), and returns how many were set. */
+int plat_mon_wait(plat_mon_t *mon, int timeout_ms, char *changed) {
+  int num_changed = 0;
+  int i;
+
+  memset(changed, 0, mon->num_files);
+
+#ifdef __linux__
+  if (mon->inot_fd >= 0) {
+    struct pollfd pfd;
+    char evbuf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    pfd.fd = mon->inot_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, timeout_ms) > 0) {
+      /* Drain all queued events; a burst of writes only needs one wakeup. */
+      while ((len = read(mon->inot_fd, evbuf, sizeof(evbuf))) > 0) {
+        char *p = evbuf;
+        while (p < evbuf + len) {
+          struct inotify_event *ev = (struct inotify_event *)p;
+          for (i = 0; i < mon->num_files; i++) {
+            if (mon->wds[i] == ev->wd) {
+              changed[i] = 1;
+              if (ev->mask & IN_IGNORED) {
+                /* Watch is gone (file deleted or its filesystem unmounted).
+                 * Poll this file from now on so remaining data still gets
+                 * drained. */
+                mon->wds[i] = -1;
+              }
+            }
+          }
+          p += sizeof(struct inotify_event) + ev->len;
+        }
+      }
+    }
+  } else {
+    plat_sleep_ms(timeout_ms);
+  }
+#else
+  plat_sleep_ms(timeout_ms);
+#endif
+
+  for (i = 0; i < mon->num_files; i++) {
+    if (mon->wds[i] == -1) {
+      changed[i] = 1;
+    }
+    num_changed += changed[i];
+  }
+  return num_changed;
+}  /* plat_mon_wait */
+
+
+void plat_mon_close(plat_mon_t *mon) {
+  if (mon->inot_fd >= 0) {
+    close(mon->inot_fd);
+  }
+  free(mon->wds);
+  free(mon);
+}  /* plat_mon_close */
+
+
+/* Call cb for each path matching a shell wildcard pattern.  A pattern
+ * that matches nothing is passed through as-is (so opening it fails
+ * with the usual error).  Returns the number of paths, or -1. */
+int plat_glob(const char *pattern, plat_glob_cb_t cb, void *arg) {
+  glob_t g;
+  size_t i;
+
+  if (glob(pattern, GLOB_NOCHECK, NULL, &g) != 0) { return -1; }
+  for (i = 0; i < g.gl_pathc; i++) {
+    cb(g.gl_pathv[i], arg);
+  }
+  globfree(&g);
+  return (int)i;
+}  /* plat_glob */
+
+
+/* Returns 1 if any file is polled, i.e. plat_mon_wait() must be called
+ * periodically rather than only when the event loop says so. */
+int plat_mon_polling(plat_mon_t *mon) {
+  int i;
+
+  if (mon->inot_fd < 0) { return 1; }
+  for (i = 0; i < mon->num_files; i++) {
+    if (mon->wds[i] == -1) { return 1; }
+  }
+  return 0;
+}  /* plat_mon_polling */
+
+
+#ifdef __linux__
+static int evl_add_fd(plat_evl_t *evl, int fd, int kind, int id) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)id;
+  return epoll_ctl(evl->ep_fd, EPOLL_CTL_ADD, fd, &ev);
+}  /* evl_add_fd */
+#endif
+
+
+/* Returns NULL if there is no event loop on this platform; the caller
+ * then falls back to threads. */
+plat_evl_t *plat_evl_create(void) {
+#ifdef __linux__
+  plat_evl_t *evl = (plat_evl_t *)calloc(1, sizeof(plat_evl_t));
+  if (evl == NULL) { return NULL; }
+
+  evl->wake_fd = -1;
+  evl->sig_fd = -1;
+  evl->ep_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (evl->ep_fd < 0) { free(evl); return NULL; }
+  return evl;
+#else
+  return NULL;
+#endif
+}  /* plat_evl_create */
+
+
+int plat_evl_add_sock(plat_evl_t *evl, plat_sock_t sock, int id) {
+#ifdef __linux__
+  return evl_add_fd(evl, sock, EVL_KIND_USER, id);
+#else
+  (void)evl; (void)sock; (void)id;
+  return -1;
+#endif
+}  /* plat_evl_add_sock */
+
+
+int plat_evl_del_sock(plat_evl_t *evl, plat_sock_t sock) {
+#ifdef __linux__
+  return epoll_ctl(evl->ep_fd, EPOLL_CTL_DEL, sock, NULL);
+#else
+  (void)evl; (void)sock;
+  return -1;
+#endif
+}  /* plat_evl_del_sock */
+
+
+/* Readable when plat_mon_wait(mon, 0, ...) has changes to report.  Fails
+ * if the monitor has no inotify descriptor (polling only). */
+int plat_evl_add_mon(plat_evl_t *evl, plat_mon_t *mon, int id) {
+#ifdef __linux__
+  if (mon->inot_fd < 0) { return -1; }
+  return evl_add_fd(evl, mon->inot_fd, EVL_KIND_USER, id);
+#else
+  (void)evl; (void)mon; (void)id;
+  return -1;
+#endif
+}  /* plat_evl_add_mon */
+
+
+/* Readable after plat_evl_wake() (which any thread may call). */
+int plat_evl_add_wake(plat_evl_t *evl, int id) {
+#ifdef __linux__
+  evl->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (evl->wake_fd < 0) { return -1; }
+  return evl_add_fd(evl, evl->wake_fd, EVL_KIND_WAKE, id);
+#else
+  (void)evl; (void)id;
+  return -1;
+#endif
+}  /* plat_evl_add_wake */
+
+
+/* Deliver SIGINT and SIGCHLD through the loop instead of as async
+ * signals (they are blocked; see plat_evl_signals()).  Call before
+ * creating any threads so that they inherit the mask. */
+int plat_evl_add_signals(plat_evl_t *evl, int id) {
+#ifdef __linux__
+  sigset_t mask;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) { return -1; }
+  evl->sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (evl->sig_fd < 0) { return -1; }
+  return evl_add_fd(evl, evl->sig_fd, EVL_KIND_SIG, id);
+#else
+  (void)evl; (void)id;
+  return -1;
+#endif
+}  /* plat_evl_add_signals */
+
+
+/* Wait up to timeout_ms (-1 = forever) for events.  Stores the ids of
+ * ready registrations in ids[] and returns how many (0 on timeout). */
+int plat_evl_wait(plat_evl_t *evl, int timeout_ms, int *ids, int max_ids) {
+#ifdef __linux__
+  struct epoll_event evs[64];
+  int n, i;
+
+  if (max_ids > 64) { max_ids = 64; }
+  n = epoll_wait(evl->ep_fd, evs, max_ids, timeout_ms);
+  if (n < 0) { return 0; }  /* EINTR. */
+
+  for (i = 0; i < n; i++) {
+    int kind = (int)(evs[i].data.u64 >> 32);
+    ids[i] = (int)(uint32_t)evs[i].data.u64;
+    if (kind == EVL_KIND_WAKE) {
+      uint64_t val;
+      if (read(evl->wake_fd, &val, sizeof(val)) < 0) { /* Already drained. */ }
+    } else if (kind == EVL_KIND_SIG) {
+      struct signalfd_siginfo si;
+      while (read(evl->sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+        if (si.ssi_signo == SIGINT) { evl->sigs |= PLAT_SIG_INT; }
+        if (si.ssi_signo == SIGCHLD) { evl->sigs |= PLAT_SIG_CHLD; }
+      }
+    }
+  }
+  return n;
+#else
+  (void)evl; (void)timeout_ms; (void)ids; (void)max_ids;
+  return 0;
+#endif
+}  /* plat_evl_wait */
+
+
+void plat_evl_wake(plat_evl_t *evl) {
+#ifdef __linux__
+  uint64_t one = 1;
+  if (write(evl->wake_fd, &one, sizeof(one)) < 0) { /* Counter full; already awake. */ }
+#else
+  (void)evl;
+#endif
+}  /* plat_evl_wake */
+
+
+/* Returns (and clears) the PLAT_SIG_* bits received so far. */
+int plat_evl_signals(plat_evl_t *evl) {
+  int sigs = evl->sigs;
+  evl->sigs = 0;
+  return sigs;
+}  /* plat_evl_signals */
+
+
+void plat_evl_close(plat_evl_t *evl) {
+  if (evl->wake_fd >= 0) { close(evl->wake_fd); }
+  if (evl->sig_fd >= 0) { close(evl->sig_fd); }
+  close(evl->ep_fd);
+  free(evl);
+}  /* plat_evl_close */
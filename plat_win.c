@@ -20,6 +20,13 @@
 static plat_proc_t *s_proc_ptr = NULL;
 static int *s_running_ptr = NULL;
 
+/* File monitor state.  Windows has no per-file change notification
+ * that fits here, so plat_mon_wait() just sleeps and reports every
+ * file as changed (polling). */
+struct plat_mon_s {
+  int num_files;
+};
+
 struct thread_wrap {
   plat_thread_func_t func;
   void *arg;
@@ -60,6 +67,39 @@ void plat_sleep_ms(int ms) {
 }  /* plat_sleep_ms */
 
 
+uint64_t plat_monotonic_ns(void) {
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0) { QueryPerformanceFrequency(&freq); }
+  QueryPerformanceCounter(&now);
+  /* Split to avoid overflowing 64 bits. */
+  return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000 +
+      (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}  /* plat_monotonic_ns */
+
+
+/* Wall clock time (ns since 1970), as used in capture timestamps. */
+uint64_t plat_wall_ns(void) {
+  FILETIME ft;
+  ULARGE_INTEGER t;
+  GetSystemTimePreciseAsFileTime(&ft);
+  t.LowPart = ft.dwLowDateTime;  t.HighPart = ft.dwHighDateTime;
+  /* FILETIME counts 100 ns units since 1601. */
+  return (t.QuadPart - 116444736000000000ULL) * 100;
+}  /* plat_wall_ns */
+
+
+/* CPU time used by the calling thread. */
+uint64_t plat_thread_cpu_ns(void) {
+  FILETIME created, exited, kernel, user;
+  ULARGE_INTEGER k, u;
+  if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) { return 0; }
+  k.LowPart = kernel.dwLowDateTime;  k.HighPart = kernel.dwHighDateTime;
+  u.LowPart = user.dwLowDateTime;  u.HighPart = user.dwHighDateTime;
+  return (k.QuadPart + u.QuadPart) * 100;  /* FILETIME is in 100 ns units. */
+}  /* plat_thread_cpu_ns */
+
+
 int plat_thread_create(plat_thread_t *thr, plat_thread_func_t func, void *arg) {
   struct thread_wrap *tw = malloc(sizeof(*tw));
   if (tw == NULL) { return -1; }  /* Handle error. */
@@ -80,11 +120,79 @@ int plat_thread_join(plat_thread_t thr) {
 }  /* plat_thread_join */
 
 
+/* Pin the calling thread to one CPU. */
+int plat_thread_pin(int cpu) {
+  if (cpu >= (int)(sizeof(DWORD_PTR) * 8)) { return -1; }
+  return (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) == 0) ? -1 : 0;
+}  /* plat_thread_pin */
+
+
+/* Atomically add n to *p; returns the old value.  A full barrier. */
+int plat_fetch_add(volatile int *p, int n) {
+  return (int)InterlockedExchangeAdd((volatile LONG *)p, (LONG)n);
+}  /* plat_fetch_add */
+
+
+int plat_sem_init(plat_sem_t *sem, int count) {
+  *sem = CreateSemaphore(NULL, count, 0x7fffffff, NULL);
+  return (*sem == NULL) ? -1 : 0;
+}  /* plat_sem_init */
+
+
+void plat_sem_wait(plat_sem_t *sem) {
+  WaitForSingleObject(*sem, INFINITE);
+}  /* plat_sem_wait */
+
+
+void plat_sem_post(plat_sem_t *sem) {
+  ReleaseSemaphore(*sem, 1, NULL);
+}  /* plat_sem_post */
+
+
+void plat_sem_destroy(plat_sem_t *sem) {
+  CloseHandle(*sem);
+}  /* plat_sem_destroy */
+
+
 int plat_close_sock(plat_sock_t sock) {
   return closesocket(sock);
 }  /* plat_close_sock */
 
 
+/* Start connecting without waiting.  Returns 0 if connected, 1 if in
+ * progress (see plat_connect_check), -1 if it failed. */
+int plat_connect_start(plat_sock_t sock, const struct sockaddr *addr, int addr_len) {
+  u_long on = 1;
+
+  if (ioctlsocket(sock, FIONBIO, &on) != 0) { return -1; }
+  if (connect(sock, addr, addr_len) == 0) {
+    on = 0;
+    ioctlsocket(sock, FIONBIO, &on);
+    return 0;
+  }
+  return (WSAGetLastError() == WSAEWOULDBLOCK) ? 1 : -1;
+}  /* plat_connect_start */
+
+
+/* Check on a connect in progress (doesn't wait).  Returns 0 if it is now
+ * connected (and the socket blocking again), 1 if still in progress, -1
+ * if it failed.  (Windows reports a failed connect as an exception.) */
+int plat_connect_check(plat_sock_t sock) {
+  fd_set wfds, efds;
+  struct timeval tv = {0, 0};
+  u_long off = 0;
+
+  FD_ZERO(&wfds);
+  FD_ZERO(&efds);
+  FD_SET(sock, &wfds);
+  FD_SET(sock, &efds);
+  if (select(0, NULL, &wfds, &efds, &tv) <= 0) { return 1; }
+  if (FD_ISSET(sock, &efds)) { return -1; }
+  ioctlsocket(sock, FIONBIO, &off);
+  return 0;
+}  /* plat_connect_check */
+
+
 int plat_spawn_cmd(const char *cmd, plat_proc_t *proc) {
   STARTUPINFO si;
   PROCESS_INFORMATION pi;
@@ -136,6 +244,12 @@ int plat_kill_proc(plat_proc_t proc) {
 }  /* plat_kill_proc */
 
 
+/* Returns 1 if the process has exited, else 0. */
+int plat_proc_exited(plat_proc_t proc) {
+  return (WaitForSingleObject(proc.hProcess, 0) == WAIT_OBJECT_0);
+}  /* plat_proc_exited */
+
+
 int plat_wait_proc(plat_proc_t proc) {
   DWORD rc = WaitForSingleObject(proc.hProcess, INFINITE);
   CloseHandle(proc.hProcess);
@@ -148,3 +262,132 @@ void plat_install_ctrl_handler(plat_proc_t *proc_ptr, int *running_ptr) {
   s_running_ptr = running_ptr;
   SetConsoleCtrlHandler(ctrl_handler, TRUE);
 }  /* plat_install_ctrl_handler */
+
+
+plat_mon_t *plat_mon_create(void) {
+  return (plat_mon_t *)calloc(1, sizeof(plat_mon_t));
+}  /* plat_mon_create */
+
+
+int plat_mon_add(plat_mon_t *mon, const char *path) {
+  (void)path;
+  return mon->num_files++;
+}  /* plat_mon_add */
+
+
+int plat_mon_wait(plat_mon_t *mon, int timeout_ms, char *changed) {
+  Sleep(timeout_ms);
+  memset(changed, 1, mon->num_files);
+  return mon->num_files;
+}  /* plat_mon_wait */
+
+
+void plat_mon_close(plat_mon_t *mon) {
+  free(mon);
+}  /* plat_mon_close */
+
+
+/* Call cb for each path matching a wildcard pattern (wildcards in the
+ * last path component only).  A pattern that matches nothing is passed
+ * through as-is.  Returns the number of paths, or -1. */
+int plat_glob(const char *pattern, plat_glob_cb_t cb, void *arg) {
+  WIN32_FIND_DATAA fd;
+  HANDLE h;
+  char path[MAX_PATH];
+  const char *sep;
+  size_t dir_len;
+  int count = 0;
+
+  if (strpbrk(pattern, "*?") == NULL) {
+    cb(pattern, arg);
+    return 1;
+  }
+
+  /* FindFirstFile returns bare names; keep the directory prefix. */
+  sep = strrchr(pattern, '\\');
+  if (strrchr(pattern, '/') > sep) { sep = strrchr(pattern, '/'); }
+  dir_len = (sep == NULL) ? 0 : (size_t)(sep - pattern + 1);
+  if (dir_len >= sizeof(path)) { return -1; }
+
+  h = FindFirstFileA(pattern, &fd);
+  if (h == INVALID_HANDLE_VALUE) {
+    cb(pattern, arg);
+    return 1;
+  }
+  do {
+    if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) { continue; }
+    if (dir_len + strlen(fd.cFileName) >= sizeof(path)) { continue; }
+    memcpy(path, pattern, dir_len);
+    strcpy(path + dir_len, fd.cFileName);
+    cb(path, arg);
+    count++;
+  } while (FindNextFileA(h, &fd));
+  FindClose(h);
+
+  return count;
+}  /* plat_glob */
+
+
+int plat_mon_polling(plat_mon_t *mon) {
+  (void)mon;
+  return 1;
+}  /* plat_mon_polling */
+
+
+/* There is no event loop backend on Windows; dual_cap uses threads. */
+plat_evl_t *plat_evl_create(void) {
+  return NULL;
+}  /* plat_evl_create */
+
+
+int plat_evl_add_sock(plat_evl_t *evl, plat_sock_t sock, int id) {
+  (void)evl; (void)sock; (void)id;
+  return -1;
+}  /* plat_evl_add_sock */
+
+
+int plat_evl_del_sock(plat_evl_t *evl, plat_sock_t sock) {
+  (void)evl; (void)sock;
+  return -1;
+}  /* plat_evl_del_sock */
+
+
+int plat_evl_add_mon(plat_evl_t *evl, plat_mon_t *mon, int id) {
+  (void)evl; (void)mon; (void)id;
+  return -1;
+}  /* plat_evl_add_mon */
+
+
+int plat_evl_add_wake(plat_evl_t *evl, int id) {
+  (void)evl; (void)id;
+  return -1;
+}  /* plat_evl_add_wake */
+
+
+int plat_evl_add_signals(plat_evl_t *evl, int id) {
+  (void)evl; (void)id;
+  return -1;
+}  /* plat_evl_add_signals */
+
+
+int plat_evl_wait(plat_evl_t *evl, int timeout_ms, int *ids, int max_ids) {
+  (void)evl; (void)ids; (void)max_ids;
+  Sleep(timeout_ms);
+  return 0;
+}  /* plat_evl_wait */
+
+
+void plat_evl_wake(plat_evl_t *evl) {
+  (void)evl;
+}  /* plat_evl_wake */
+
+
+int plat_evl_signals(plat_evl_t *evl) {
+  (void)evl;
+  return 0;
+}  /* plat_evl_signals */
+
+
+void plat_evl_close(plat_evl_t *evl) {
+  (void)evl;
+}  /* plat_evl_close */
@@ -11,10 +11,12 @@
  * Project home: https://github.com/fordsfords/re
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  /* For memmem. */
+#endif
 #include "re.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 
 /* Simple error handling. */
@@ -28,15 +30,19 @@
 /* Definitions: */
 
 
+/* DOT and the types from CHAR_CLASS on match with a bitmap (u.map). */
 enum { UNUSED, DOT, BEGIN, END, QUESTIONMARK, STAR, PLUS, CHAR, CHAR_CLASS, INV_CHAR_CLASS, DIGIT, NOT_DIGIT, ALPHA, NOT_ALPHA, WHITESPACE, NOT_WHITESPACE };
 
+#define MAP_SIZE 32  /* Bytes in a 256-bit bitmap. */
+
 
 /* Private function declarations: */
-static int matchpattern(regex_t* re_compiled, const char* text, int* matchlength);
+static int matchpattern(regex_t* re_compiled, const char* text, const char* end, int* matchlength);
 static int matchcharclass(char c, const char* str);
-static int matchstar(regex_t p, regex_t* re_compiled, const char* text, int* matchlength);
-static int matchplus(regex_t p, regex_t* re_compiled, const char* text, int* matchlength);
+static int matchstar(regex_t p, regex_t* re_compiled, const char* text, const char* end, int* matchlength);
+static int matchplus(regex_t p, regex_t* re_compiled, const char* text, const char* end, int* matchlength);
 static int matchone(regex_t p, char c);
+static int classone(int type, char c, const char* ccl);
 static int matchdigit(char c);
 static int matchalpha(char c);
 static int matchwhitespace(char c);
@@ -44,6 +50,24 @@ static int matchmetachar(char c, const char* str);
 static int matchrange(char c, const char* str);
 static int matchdot(char c);
 static int ismetachar(char c);
+static int can_backtrack(regex_t* re_compiled);
+static void extract_literal(re_t *re);
+static const char* find_literal(const char* text, int text_len, const char* lit, int lit_len);
+/* Start a new (empty) thread list. */
+static void vm_new_list(re_t *re)
+{
+  re->vm_gen++;
+  if (re->vm_gen == 0)
+  {
+    /* Wrapped; old marks could alias the new generation. */
+    memset(re->vm_mark, 0, re->max_regexp_objects * sizeof(unsigned int));
+    re->vm_gen = 1;
+  }
+}
+
+static int vm_match(re_t *re, const char* text, int text_len, int *idx_out, int *len_out);
+
+static const re_gen_entry_t *gen_table = NULL;
 
 
 re_t *re_compile(const char* pattern)
@@ -54,9 +78,12 @@ re_t *re_compile(const char* pattern)
   re->max_regexp_objects = max_regexp_objects;
   re->re_compiled = re_compiled;
 
-  unsigned char *ccl_buf = re->ccl_buf;
-  ccl_buf[0] = '\0';
-  int ccl_bufidx = 1;
+  /* A class's contents while it is lowered to a bitmap (see
+   * matchcharclass, which needs a 0 before them). */
+  char *ccl = (char *)malloc(max_regexp_objects + 1);  E(ccl == NULL);
+  int ccl_len;
+  int num_maps = 0;
+  re->maps = (unsigned char *)calloc(max_regexp_objects, MAP_SIZE);  E(re->maps == NULL);
 
   char c;     /* current char in pattern   */
   int i = 0;  /* index into pattern        */
@@ -105,9 +132,6 @@ re_t *re_compile(const char* pattern)
       /* Character class: */
       case '[':
       {
-        /* Remember where the char-buffer starts. */
-        int buf_begin = ccl_bufidx;
-
         /* Look-ahead to determine if negated */
         if (pattern[i+1] == '^')
         {
@@ -121,24 +145,20 @@ re_t *re_compile(const char* pattern)
         }
 
         /* Copy characters inside [..] to buffer */
+        ccl[0] = '\0';
+        ccl_len = 0;
         while (    (pattern[++i] != ']')
                 && (pattern[i]   != '\0')) /* Missing ] */
         {
           if (pattern[i] == '\\')
           {
-            E(ccl_bufidx >= MAX_CHAR_CLASS_LEN - 1);
             E(pattern[i+1] == 0);
-            ccl_buf[ccl_bufidx++] = pattern[i++];
+            ccl[1 + ccl_len++] = pattern[i++];
           }
-          else E(ccl_bufidx >= MAX_CHAR_CLASS_LEN);
-
-          ccl_buf[ccl_bufidx++] = pattern[i];
+          ccl[1 + ccl_len++] = pattern[i];
         }
-        /* Catch cases such as [00000000000000000000000000000000000000][ */
-        E(ccl_bufidx >= MAX_CHAR_CLASS_LEN);
         /* Null-terminate string end */
-        ccl_buf[ccl_bufidx++] = 0;
-        re_compiled[j].u.ccl = &ccl_buf[buf_begin];
+        ccl[1 + ccl_len] = 0;
       } break;
 
       /* Other characters: */
@@ -151,11 +171,48 @@ re_t *re_compile(const char* pattern)
     /* no buffer-out-of-bounds access on invalid patterns - see https://github.com/kokke/tiny-regex-c/commit/1a279e04014b70b0695fba559a7c05d55e6ee90b */
     E(pattern[i] == 0);
 
+    /* Lower classes, escapes and '.' to a bitmap, so that matching one
+     * byte is a single bit test. */
+    if (re_compiled[j].type == DOT || re_compiled[j].type >= CHAR_CLASS)
+    {
+      unsigned char *map = &re->maps[num_maps++ * MAP_SIZE];
+      int b;
+      for (b = 0; b < 256; b++)
+      {
+        if (classone(re_compiled[j].type, (char)b, ccl + 1))
+          map[b >> 3] |= (unsigned char)(1 << (b & 7));
+      }
+      re_compiled[j].u.map = map;
+    }
+
     i += 1;
     j += 1;
   }
   /* 'UNUSED' is a sentinel used to indicate end-of-pattern */
   re_compiled[j].type = UNUSED;
+  free(ccl);
+
+  /* Pike VM scratch: a thread list never holds an atom twice. */
+  for (i = 0; i < 2; i++)
+  {
+    re->vm_pc[i] = (int *)malloc(max_regexp_objects * sizeof(int));  E(re->vm_pc[i] == NULL);
+    re->vm_start[i] = (int *)malloc(max_regexp_objects * sizeof(int));  E(re->vm_start[i] == NULL);
+  }
+  re->vm_mark = (unsigned int *)calloc(max_regexp_objects, sizeof(unsigned int));  E(re->vm_mark == NULL);
+  re->vm_gen = 0;
+
+  re_set_engine(re, RE_ENGINE_AUTO);
+  extract_literal(re);
+
+  re->gen = NULL;
+  for (i = 0; gen_table != NULL && gen_table[i].pattern != NULL; i++)
+  {
+    if (strcmp(gen_table[i].pattern, pattern) == 0)
+    {
+      re->gen = gen_table[i].fn;
+      break;
+    }
+  }
 
   return re;
 }  /* re_compile */
@@ -163,19 +220,78 @@ re_t *re_compile(const char* pattern)
 
 void re_free(re_t *re)
 {
+  free(re->vm_pc[0]);
+  free(re->vm_pc[1]);
+  free(re->vm_start[0]);
+  free(re->vm_start[1]);
+  free(re->vm_mark);
+  free(re->lit);
+  free(re->maps);
   free(re->re_compiled);
   free(re);
 }  /* re_free */
 
 
+void re_set_engine(re_t *re, int engine)
+{
+  if (engine == RE_ENGINE_AUTO)
+  {
+    engine = can_backtrack(re->re_compiled) ? RE_ENGINE_PIKEVM : RE_ENGINE_BACKTRACK;
+  }
+  re->engine = engine;
+}  /* re_set_engine */
+
+
+void re_set_gen_table(const re_gen_entry_t *table)
+{
+  gen_table = table;
+}  /* re_set_gen_table */
+
+
 int re_match(re_t *re, const char* text, int *idx_out, int *len_out)
+{
+  return re_matchn(re, text, (int)strlen(text), idx_out, len_out);
+}  /* re_match */
+
+
+int re_matchn(re_t *re, const char* text, int text_len, int *idx_out, int *len_out)
 {
   regex_t *re_compiled = re->re_compiled;
+  const char* end = text + text_len;
   int matchlength = 0;
 
+  /* Most lines don't contain the required literal; reject them without
+   * running the matcher at all. */
+  if (re->lit_len > 0)
+  {
+    const char* found;
+    if (re->lit_anchored)
+      found = (text_len >= re->lit_len && memcmp(text, re->lit, re->lit_len) == 0) ? text : NULL;
+    else
+      found = find_literal(text, text_len, re->lit, re->lit_len);
+    if (found == NULL)
+      return 0;
+    if (re->lit_only)
+    {
+      if (idx_out) *idx_out = (int)(found - text);
+      if (len_out) *len_out = re->lit_len;
+      return 1;
+    }
+  }
+
+  if (re->gen != NULL && idx_out == NULL && len_out == NULL)
+  {
+    return re->gen(text, text_len);
+  }
+
+  if (re->engine == RE_ENGINE_PIKEVM)
+  {
+    return vm_match(re, text, text_len, idx_out, len_out);
+  }
+
   if (re_compiled[0].type == BEGIN)
   {
-    if (matchpattern(&re_compiled[1], text, &matchlength))
+    if (matchpattern(&re_compiled[1], text, end, &matchlength))
     {
       if (idx_out) *idx_out = 0;
       if (len_out) *len_out = matchlength;
@@ -186,37 +302,36 @@ int re_match(re_t *re, const char* text, int *idx_out, int *len_out)
   }
   else
   {
-    int idx = -1;
+    int idx;
 
-    do
+    for (idx = 0; idx <= text_len; idx++)
     {
-      idx += 1;
-
-      if (matchpattern(re_compiled, text, &matchlength))
+      if (matchpattern(re_compiled, text + idx, end, &matchlength))
       {
         if (idx_out) *idx_out = idx;
         if (len_out) *len_out = matchlength;
         return 1;
       }
     }
-    while (*text++ != '\0');
   }
   return 0;
-}  /* re_match */
+}  /* re_matchn */
 
 
 /* Private functions: */
+/* The classes are ASCII (as ctype's in the "C" locale), whatever the
+ * locale; they are only used to build bitmaps. */
 static int matchdigit(char c)
 {
-  return isdigit((unsigned char)c);
+  return ((c >= '0') && (c <= '9'));
 }
 static int matchalpha(char c)
 {
-  return isalpha((unsigned char)c);
+  return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')));
 }
 static int matchwhitespace(char c)
 {
-  return isspace((unsigned char)c);
+  return ((c == ' ') || ((c >= '\t') && (c <= '\r')));
 }
 static int matchalphanum(char c)
 {
@@ -293,35 +408,46 @@ static int matchcharclass(char c, const char* str)
   return 0;
 }
 
-static int matchone(regex_t p, char c)
+/* Whether c is in a class, escape class or '.' (ccl: the class's
+ * contents).  Only used by re_compile, to build the bitmaps. */
+static int classone(int type, char c, const char* ccl)
 {
-  switch (p.type)
+  switch (type)
   {
     case DOT:            return matchdot(c);
-    case CHAR_CLASS:     return  matchcharclass(c, (const char*)p.u.ccl);
-    case INV_CHAR_CLASS: return !matchcharclass(c, (const char*)p.u.ccl);
+    case CHAR_CLASS:     return  matchcharclass(c, ccl);
+    case INV_CHAR_CLASS: return !matchcharclass(c, ccl);
     case DIGIT:          return  matchdigit(c);
     case NOT_DIGIT:      return !matchdigit(c);
     case ALPHA:          return  matchalphanum(c);
     case NOT_ALPHA:      return !matchalphanum(c);
     case WHITESPACE:     return  matchwhitespace(c);
-    case NOT_WHITESPACE: return !matchwhitespace(c);
-    default:             return  (p.u.ch == c);
+    default:             return !matchwhitespace(c);  /* NOT_WHITESPACE */
+  }
+}
+
+static int matchone(regex_t p, char c)
+{
+  if (p.type == DOT || p.type >= CHAR_CLASS)
+  {
+    unsigned char b = (unsigned char)c;
+    return (p.u.map[b >> 3] >> (b & 7)) & 1;
   }
+  return (p.u.ch == c);
 }
 
-static int matchstar(regex_t p, regex_t* re_compiled, const char* text, int* matchlength)
+static int matchstar(regex_t p, regex_t* re_compiled, const char* text, const char* end, int* matchlength)
 {
   int prelen = *matchlength;
   const char* prepoint = text;
-  while ((text[0] != '\0') && matchone(p, *text))
+  while ((text < end) && matchone(p, *text))
   {
     text++;
     (*matchlength)++;
   }
   while (text >= prepoint)
   {
-    if (matchpattern(re_compiled, text--, matchlength))
+    if (matchpattern(re_compiled, text--, end, matchlength))
       return 1;
     (*matchlength)--;
   }
@@ -330,17 +456,17 @@ static int matchstar(regex_t p, regex_t* re_compiled, const char* text, int* mat
   return 0;
 }
 
-static int matchplus(regex_t p, regex_t* re_compiled, const char* text, int* matchlength)
+static int matchplus(regex_t p, regex_t* re_compiled, const char* text, const char* end, int* matchlength)
 {
   const char* prepoint = text;
-  while ((text[0] != '\0') && matchone(p, *text))
+  while ((text < end) && matchone(p, *text))
   {
     text++;
     (*matchlength)++;
   }
   while (text > prepoint)
   {
-    if (matchpattern(re_compiled, text--, matchlength))
+    if (matchpattern(re_compiled, text--, end, matchlength))
       return 1;
     (*matchlength)--;
   }
@@ -348,50 +474,398 @@ static int matchplus(regex_t p, regex_t* re_compiled, const char* text, int* mat
   return 0;
 }
 
-static int matchquestion(regex_t p, regex_t* re_compiled, const char* text, int* matchlength)
+static int matchquestion(regex_t p, regex_t* re_compiled, const char* text, const char* end, int* matchlength)
 {
   if (p.type == UNUSED)
     return 1;
-  if (*text && matchone(p, *text))
+  if ((text < end) && matchone(p, *text))
   {
-    if (matchpattern(re_compiled, text + 1, matchlength))
+    if (matchpattern(re_compiled, text + 1, end, matchlength))
     {
       (*matchlength)++;
       return 1;
     }
   }
-  if (matchpattern(re_compiled, text, matchlength))
+  if (matchpattern(re_compiled, text, end, matchlength))
       return 1;
   return 0;
 }
 
 
 /* Iterative matching */
-static int matchpattern(regex_t* re_compiled, const char* text, int* matchlength)
+static int matchpattern(regex_t* re_compiled, const char* text, const char* end, int* matchlength)
 {
   int pre = *matchlength;
   do
   {
     if ((re_compiled[0].type == UNUSED) || (re_compiled[1].type == QUESTIONMARK))
     {
-      return matchquestion(re_compiled[0], &re_compiled[2], text, matchlength);
+      return matchquestion(re_compiled[0], &re_compiled[2], text, end, matchlength);
     }
     else if (re_compiled[1].type == STAR)
     {
-      return matchstar(re_compiled[0], &re_compiled[2], text, matchlength);
+      return matchstar(re_compiled[0], &re_compiled[2], text, end, matchlength);
     }
     else if (re_compiled[1].type == PLUS)
     {
-      return matchplus(re_compiled[0], &re_compiled[2], text, matchlength);
+      return matchplus(re_compiled[0], &re_compiled[2], text, end, matchlength);
     }
     else if ((re_compiled[0].type == END) && re_compiled[1].type == UNUSED)
     {
-      return (text[0] == '\0' || (text[0] == '\n' && text[1] == '\0'));
+      return (text == end || (text[0] == '\n' && text + 1 == end));
     }
   (*matchlength)++;
   }
-  while ((text[0] != '\0') && matchone(*re_compiled++, *text++));
+  while ((text < end) && matchone(*re_compiled++, *text++));
 
   *matchlength = pre;
   return 0;
 }
+
+
+/* A pattern can backtrack heavily if it has more than one unbounded
+ * repeat, or a repeat of something that can run to the end of the line
+ * (then every start offset rescans the rest of the line). */
+static int can_backtrack(regex_t* re_compiled)
+{
+  int repeats = 0;
+  int i;
+
+  for (i = 1; re_compiled[i - 1].type != UNUSED; i++)
+  {
+    if (re_compiled[i].type == STAR || re_compiled[i].type == PLUS)
+    {
+      switch (re_compiled[i - 1].type)
+      {
+        case DOT: case INV_CHAR_CLASS: case NOT_DIGIT: case NOT_ALPHA: case NOT_WHITESPACE:
+          return 1;
+        default:
+          repeats++;
+      }
+    }
+  }
+  return (repeats > 1);
+}
+
+
+/* Find the longest run of consecutive CHAR atoms that every match must
+ * contain.  A '+' atom is required once but ends the run; atoms under
+ * '*' or '?' and non-CHAR atoms just end it.  For "^lit..." patterns the
+ * leading run is used instead: comparing at offset 0 beats a search. */
+static void extract_literal(re_t *re)
+{
+  regex_t* p = re->re_compiled;
+  int best_start = 0, best_len = 0;
+  int cur_start = 0, cur_len = 0;
+  int n_atoms = 0;
+  int only = 1;
+  int i, k;
+
+  re->lit = (char *)malloc(re->max_regexp_objects);  E(re->lit == NULL);
+
+  for (i = 0; p[i].type != UNUSED; i++)
+  {
+    int q = p[i + 1].type;
+    int quantified = (q == STAR || q == PLUS || q == QUESTIONMARK);
+
+    n_atoms++;
+    if (p[i].type == CHAR && q != STAR && q != QUESTIONMARK)
+    {
+      if (cur_len == 0)
+        cur_start = i;
+      cur_len++;
+      if (cur_len > best_len)
+      {
+        best_start = cur_start;
+        best_len = cur_len;
+      }
+    }
+    else
+    {
+      only = 0;
+    }
+
+    if (quantified)
+    {
+      only = 0;
+      cur_len = 0;
+      i++;  /* Skip the quantifier. */
+    }
+    else if (p[i].type != CHAR)
+    {
+      cur_len = 0;
+    }
+
+    if (p[0].type == BEGIN && best_start == 1 && best_len > 0 && cur_len == 0)
+      break;  /* Leading run of an anchored pattern is complete. */
+  }
+  re->lit_anchored = (p[0].type == BEGIN && best_start == 1);
+
+  /* Copy the run's characters (atoms are contiguous, one char each). */
+  for (k = 0; k < best_len; k++)
+  {
+    re->lit[k] = (char)p[best_start + k].u.ch;
+  }
+  re->lit_len = best_len;
+  re->lit_only = (only && best_len > 0 && best_len == n_atoms);
+}
+
+static const char* find_literal(const char* text, int text_len, const char* lit, int lit_len)
+{
+#ifdef __GLIBC__
+  return (const char*)memmem(text, text_len, lit, lit_len);
+#else
+  const char* end = text + text_len;
+  while (end - text >= lit_len)
+  {
+    text = (const char*)memchr(text, lit[0], (end - text) - lit_len + 1);
+    if (text == NULL)
+      return NULL;
+    if (memcmp(text, lit, lit_len) == 0)
+      return text;
+    text++;
+  }
+  return NULL;
+#endif
+}
+
+
+/* Pike VM.  The program is simulated as a Thompson NFA: a thread is the
+ * index of an atom waiting to consume one character.  Each list keeps
+ * its threads in priority order (greedy repeats prefer to consume), and
+ * a match cuts off all lower-priority threads, so the result is the same
+ * leftmost match the backtracker finds, in O(pattern x text) time. */
+
+/* Add the thread for atom pc, plus everything reachable from it without
+ * consuming a character. */
+static void vm_add(re_t *re, int *pcs, int *starts, int *n, int pc, int start)
+{
+  regex_t* p = re->re_compiled;
+
+  while (re->vm_mark[pc] != re->vm_gen)
+  {
+    re->vm_mark[pc] = re->vm_gen;
+    pcs[*n] = pc;
+    starts[*n] = start;
+    (*n)++;
+
+    /* Accept states and required atoms end the chain. */
+    if (p[pc].type == UNUSED)
+      return;
+    if (p[pc + 1].type != QUESTIONMARK && p[pc + 1].type != STAR)
+      return;
+    /* Optional atom: also try skipping it (lower priority). */
+    pc += 2;
+  }
+}
+
+/* Add the threads that follow atom pc consuming a character. */
+static void vm_follow(re_t *re, int *pcs, int *starts, int *n, int pc, int start)
+{
+  regex_t* p = re->re_compiled;
+
+  switch (p[pc + 1].type)
+  {
+    case STAR:
+    case PLUS:
+      vm_add(re, pcs, starts, n, pc, start);  /* Loop again (greedy). */
+      vm_add(re, pcs, starts, n, pc + 2, start);
+      break;
+    case QUESTIONMARK:
+      vm_add(re, pcs, starts, n, pc + 2, start);
+      break;
+    default:
+      vm_add(re, pcs, starts, n, pc + 1, start);
+      break;
+  }
+}
+
+static int vm_match(re_t *re, const char* text, int text_len, int *idx_out, int *len_out)
+{
+  regex_t* p = re->re_compiled;
+  int anchored = (p[0].type == BEGIN);
+  int start_pc = anchored ? 1 : 0;
+  int *cpc = re->vm_pc[0], *cst = re->vm_start[0];
+  int *npc = re->vm_pc[1], *nst = re->vm_start[1];
+  int *tmp;
+  int cn = 0, nn;
+  int matched = 0, m_start = 0, m_end = 0;
+  int i, t;
+
+  vm_new_list(re);
+  vm_add(re, cpc, cst, &cn, start_pc, 0);
+
+  for (i = 0; cn > 0; i++)
+  {
+    vm_new_list(re);
+    nn = 0;
+    for (t = 0; t < cn; t++)
+    {
+      int pc = cpc[t];
+      if (p[pc].type == UNUSED)
+      {
+        matched = 1; m_start = cst[t]; m_end = i;
+        break;  /* Lower-priority threads lose. */
+      }
+      else if (p[pc].type == END && p[pc + 1].type == UNUSED)
+      {
+        if (i == text_len || (text[i] == '\n' && i + 1 == text_len))
+        {
+          matched = 1; m_start = cst[t]; m_end = i;
+          break;
+        }
+      }
+      else if (i < text_len && matchone(p[pc], text[i]))
+      {
+        vm_follow(re, npc, nst, &nn, pc, cst[t]);
+      }
+    }
+    if (i >= text_len)
+      break;
+
+    /* Start a new attempt at the next offset, at lowest priority. */
+    if (!anchored && !matched)
+      vm_add(re, npc, nst, &nn, start_pc, i + 1);
+
+    tmp = cpc; cpc = npc; npc = tmp;
+    tmp = cst; cst = nst; nst = tmp;
+    cn = nn;
+  }
+
+  if (matched)
+  {
+    if (idx_out) *idx_out = m_start;
+    if (len_out) *len_out = m_end - m_start;
+  }
+  return matched;
+}
+
+
+int re_nfa_start(re_t *re, int *pcs_out)
+{
+  int n = 0;
+
+  vm_new_list(re);
+  vm_add(re, pcs_out, re->vm_start[0], &n, (re->re_compiled[0].type == BEGIN) ? 1 : 0, 0);
+  return n;
+}
+
+int re_nfa_step(re_t *re, const int *pcs, int n, unsigned char c, int *pcs_out)
+{
+  regex_t* p = re->re_compiled;
+  int nn = 0;
+  int t;
+
+  vm_new_list(re);
+  for (t = 0; t < n; t++)
+  {
+    int pc = pcs[t];
+    if (p[pc].type != UNUSED && !(p[pc].type == END && p[pc + 1].type == UNUSED)
+        && matchone(p[pc], (char)c))
+    {
+      vm_follow(re, pcs_out, re->vm_start[0], &nn, pc, 0);
+    }
+  }
+  if (p[0].type != BEGIN)
+    vm_add(re, pcs_out, re->vm_start[0], &nn, 0, 0);
+  return nn;
+}
+
+int re_nfa_accept(re_t *re, const int *pcs, int n)
+{
+  regex_t* p = re->re_compiled;
+  int accept = 0;
+  int t;
+
+  for (t = 0; t < n; t++)
+  {
+    if (p[pcs[t]].type == UNUSED)
+      return 1;
+    if (p[pcs[t]].type == END && p[pcs[t] + 1].type == UNUSED)
+      accept = 2;
+  }
+  return accept;
+}
+
+
+re_stream_t *re_stream_create(re_t *re)
+{
+  re_stream_t *rs = (re_stream_t *)calloc(1, sizeof(re_stream_t));  E(rs == NULL);
+  rs->pcs = (int *)malloc(re->max_regexp_objects * sizeof(int));  E(rs->pcs == NULL);
+  return rs;
+}
+
+void re_stream_free(re_stream_t *rs)
+{
+  free(rs->pcs);
+  free(rs);
+}
+
+void re_stream_start(re_t *re, re_stream_t *rs)
+{
+  int start_pc = (re->re_compiled[0].type == BEGIN) ? 1 : 0;
+
+  vm_new_list(re);
+  rs->n = 0;
+  rs->matched = 0;
+  vm_add(re, rs->pcs, re->vm_start[0], &rs->n, start_pc, 0);
+}
+
+/* As vm_match, but starting from (and leaving) the stream's thread list,
+ * and only asking whether there is a match, not where. */
+int re_stream_feed(re_t *re, re_stream_t *rs, const char* text, int text_len, int last)
+{
+  regex_t* p = re->re_compiled;
+  int anchored = (p[0].type == BEGIN);
+  int start_pc = anchored ? 1 : 0;
+  int *cpc = re->vm_pc[0];
+  int *npc = re->vm_pc[1];
+  int *tmp;
+  int cn = rs->n, nn;
+  int i, t;
+
+  if (rs->matched)
+    return 1;
+  memcpy(cpc, rs->pcs, cn * sizeof(int));
+
+  for (i = 0; cn > 0; i++)
+  {
+    vm_new_list(re);
+    nn = 0;
+    for (t = 0; t < cn; t++)
+    {
+      int pc = cpc[t];
+      if (p[pc].type == UNUSED)
+      {
+        rs->matched = 1;
+        return 1;
+      }
+      else if (p[pc].type == END && p[pc + 1].type == UNUSED)
+      {
+        if (last && (i == text_len || (text[i] == '\n' && i + 1 == text_len)))
+        {
+          rs->matched = 1;
+          return 1;
+        }
+      }
+      else if (i < text_len && matchone(p[pc], text[i]))
+      {
+        vm_follow(re, npc, re->vm_start[1], &nn, pc, 0);
+      }
+    }
+    if (i >= text_len)
+      break;
+
+    /* Start a new attempt at the next offset. */
+    if (!anchored)
+      vm_add(re, npc, re->vm_start[1], &nn, start_pc, 0);
+
+    tmp = cpc; cpc = npc; npc = tmp;
+    cn = nn;
+  }
+
+  /* Threads still waiting for a character wait for the next piece. */
+  memcpy(rs->pcs, cpc, cn * sizeof(int));
+  rs->n = cn;
+  return 0;
+}
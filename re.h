@@ -14,7 +14,10 @@
 #ifndef RE_H
 #define RE_H
 
-#define MAX_CHAR_CLASS_LEN      256   /* Total char-class buffer for all classes in a pattern. */
+/* Matching engines (see re_set_engine). */
+#define RE_ENGINE_AUTO          0     /* Pike VM if the pattern can backtrack heavily. */
+#define RE_ENGINE_BACKTRACK     1     /* Recursive backtracking; fastest on simple patterns. */
+#define RE_ENGINE_PIKEVM        2     /* Thompson NFA simulation; O(pattern x text). */
 
 #include <stdio.h>
 
@@ -23,6 +26,17 @@ extern "C" {
 #endif /* __cplusplus */
 
 
+/* A matcher generated by re_gen for one pattern: returns 1 if text
+ * matches, like re_matchn, but not where. */
+typedef int (*re_gen_fn_t)(const char* text, int text_len);
+
+/* re_gen's table of generated matchers, ending with a NULL pattern. */
+typedef struct re_gen_entry_s
+{
+  const char *pattern;         /* Source string, exactly as compiled. */
+  re_gen_fn_t fn;
+} re_gen_entry_t;
+
 /* Typedef'd pointer to get abstract datatype. */
 typedef struct regex_s
 {
@@ -30,24 +44,78 @@ typedef struct regex_s
   union
   {
     unsigned char  ch;   /*      the character itself             */
-    unsigned char* ccl;  /*  OR  a pointer to characters in class */
+    const unsigned char* map;  /*  OR  256-bit membership bitmap    */
   } u;
 } regex_t;
 
 typedef struct re_s {
   int max_regexp_objects;
   regex_t *re_compiled;
-  unsigned char ccl_buf[MAX_CHAR_CLASS_LEN];  /* Storage for character class contents. */
+  unsigned char *maps;         /* Bitmaps of the classes, escapes and '.' (32 bytes each). */
+  int engine;                  /* RE_ENGINE_BACKTRACK or RE_ENGINE_PIKEVM. */
+  int *vm_pc[2];               /* Pike VM thread lists: atom index per thread. */
+  int *vm_start[2];            /* Pike VM thread lists: match start offset per thread. */
+  unsigned int *vm_mark;       /* Pike VM: list generation an atom was last added in. */
+  unsigned int vm_gen;
+  char *lit;                   /* Longest literal every match must contain. */
+  int lit_len;                 /* 0 if the pattern has no required literal. */
+  int lit_only;                /* Pattern is exactly lit (unanchored, no operators). */
+  int lit_anchored;            /* lit must be at the start of the text (pattern is ^lit...). */
+  re_gen_fn_t gen;             /* Generated matcher (see re_set_gen_table), or NULL. */
 } re_t;
 
+/* Streaming match state (see re_stream_feed): the Pike VM's thread list
+ * between pieces of a line. */
+typedef struct re_stream_s {
+  int *pcs;                    /* Threads waiting for the next piece. */
+  int n;
+  int matched;                 /* The line is known to match. */
+} re_stream_t;
 
-/* Compile regex string pattern. max_regexp_objects is roughly the pattern length. */
+
+/* Compile regex string pattern. max_regexp_objects is roughly the pattern length.
+ * The engine defaults to RE_ENGINE_AUTO. */
 re_t *re_compile(const char* pattern);
 void re_free(re_t *re);
+/* Select the matching engine.  Both engines agree on whether a line
+ * matches and where the match starts; the reported match length may
+ * differ (the backtracker's can be off, e.g. for '.$').
+ * A re_t holds Pike VM scratch space, so do not match with one re_t
+ * from two threads at the same time. */
+void re_set_engine(re_t *re, int engine);
+/* Patterns compiled after this whose source is in table use its
+ * generated matcher, instead of either engine, when re_matchn is not
+ * asked for the match position.  NULL to stop. */
+void re_set_gen_table(const re_gen_entry_t *table);
 
 
 /* Find matches of the compiled pattern inside text. */
 int re_match(re_t *re, const char* text, int *idx_out, int *len_out);
+/* Same, but text is text_len bytes and need not be null-terminated. */
+int re_matchn(re_t *re, const char* text, int text_len, int *idx_out, int *len_out);
+
+/* NFA access, for re_gen.  A state is the set of atoms (indexes into
+ * re_compiled) that threads are waiting at, at most max_regexp_objects.
+ * re_nfa_start gives the start state and re_nfa_step the state after
+ * consuming c (including a new attempt at the next offset, unless
+ * anchored); each returns the number of atoms in pcs_out.
+ * re_nfa_accept: 1 if the state has matched, 2 if it matches only at
+ * the end of the text ('$'), 0 if neither. */
+int re_nfa_start(re_t *re, int *pcs_out);
+int re_nfa_step(re_t *re, const int *pcs, int n, unsigned char c, int *pcs_out);
+int re_nfa_accept(re_t *re, const int *pcs, int n);
+
+/* Streaming: match a line that arrives in pieces (e.g. one longer than
+ * the caller's buffer) without keeping it.  Only the Pike VM's threads
+ * carry over from piece to piece, so the state is bounded by the pattern
+ * length whatever the line length.  A stream belongs to one re_t, but
+ * several streams of one re_t may be in progress at once. */
+re_stream_t *re_stream_create(re_t *re);
+void re_stream_free(re_stream_t *rs);
+void re_stream_start(re_t *re, re_stream_t *rs);
+/* Feed the next piece of the line; last: it is the end of the line.
+ * Returns 1 once the line is known to match. */
+int re_stream_feed(re_t *re, re_stream_t *rs, const char* text, int text_len, int last);
 
 #ifdef __cplusplus
 }
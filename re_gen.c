@@ -0,0 +1,297 @@
+/* re_gen.c - Generate specialized C matchers for fixed re patterns.
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+/* Each pattern's NFA (see re_nfa_start) is turned into a DFA by subset
+ * construction.  Bytes that every state treats alike share a byte class,
+ * so the transition table has one column per class rather than per
+ * byte, and each character class in the pattern is decided by a single
+ * table lookup.  The output is C: per pattern, the tables and a function
+ * that walks them, plus a re_gen_entry_t table named re_gen_patterns
+ * (see re_set_gen_table). */
+
+#include "re.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+/* Transition tables use unsigned short state numbers. */
+#define MAX_STATES 4096
+#define HASH_SIZE 8192
+
+
+typedef struct dfa_s {
+  int num_states;
+  int **sets;        /* Per state: its NFA atoms, sorted. */
+  int *set_len;
+  int *hash_next;    /* Chain of states with the same hash. */
+  int hash_head[HASH_SIZE];
+  int *trans;        /* num_states x 256. */
+  int *accept;       /* re_nfa_accept per state. */
+  int dead;          /* The state with no atoms, or -1. */
+  unsigned char cls[256];  /* Byte -> class. */
+  int num_cls;
+} dfa_t;
+
+
+static int cmp_int(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}  /* cmp_int */
+
+
+static unsigned set_hash(const int *set, int n) {
+  unsigned h = 2166136261u;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    h = (h ^ (unsigned)set[i]) * 16777619u;
+  }
+  return h % HASH_SIZE;
+}  /* set_hash */
+
+
+/* Returns the state for the (sorted) set, adding it if new, or -1 if
+ * there are too many states. */
+static int dfa_state(dfa_t *dfa, re_t *re, int *set, int n) {
+  unsigned h = set_hash(set, n);
+  int s;
+
+  for (s = dfa->hash_head[h]; s >= 0; s = dfa->hash_next[s]) {
+    if (dfa->set_len[s] == n && memcmp(dfa->sets[s], set, n * sizeof(int)) == 0) {
+      return s;
+    }
+  }
+  if (dfa->num_states == MAX_STATES) { return -1; }
+
+  s = dfa->num_states++;
+  dfa->sets[s] = (int *)malloc((n + 1) * sizeof(int));  E(dfa->sets[s] == NULL);
+  memcpy(dfa->sets[s], set, n * sizeof(int));
+  dfa->set_len[s] = n;
+  dfa->accept[s] = re_nfa_accept(re, set, n);
+  if (n == 0) { dfa->dead = s; }
+  dfa->hash_next[s] = dfa->hash_head[h];
+  dfa->hash_head[h] = s;
+  return s;
+}  /* dfa_state */
+
+
+/* Build the DFA of re.  Returns 0 if it has too many states. */
+static int dfa_build(dfa_t *dfa, re_t *re) {
+  int *set = (int *)malloc(re->max_regexp_objects * sizeof(int));  E(set == NULL);
+  int s, c, n, t, c2, same;
+
+  memset(dfa, 0, sizeof(*dfa));
+  memset(dfa->hash_head, -1, sizeof(dfa->hash_head));
+  dfa->dead = -1;
+  dfa->sets = (int **)calloc(MAX_STATES, sizeof(int *));  E(dfa->sets == NULL);
+  dfa->set_len = (int *)calloc(MAX_STATES, sizeof(int));  E(dfa->set_len == NULL);
+  dfa->hash_next = (int *)calloc(MAX_STATES, sizeof(int));  E(dfa->hash_next == NULL);
+  dfa->accept = (int *)calloc(MAX_STATES, sizeof(int));  E(dfa->accept == NULL);
+  dfa->trans = (int *)malloc((size_t)MAX_STATES * 256 * sizeof(int));  E(dfa->trans == NULL);
+
+  n = re_nfa_start(re, set);
+  qsort(set, n, sizeof(int), cmp_int);
+  dfa_state(dfa, re, set, n);  /* State 0. */
+
+  /* New states are appended, so this visits every one. */
+  for (s = 0; s < dfa->num_states; s++) {
+    for (c = 0; c < 256; c++) {
+      n = re_nfa_step(re, dfa->sets[s], dfa->set_len[s], (unsigned char)c, set);
+      qsort(set, n, sizeof(int), cmp_int);
+      t = dfa_state(dfa, re, set, n);
+      if (t < 0) { free(set); return 0; }
+      dfa->trans[s * 256 + c] = t;
+    }
+  }
+  free(set);
+
+  /* Byte classes: bytes with identical columns. */
+  for (c = 0; c < 256; c++) {
+    for (c2 = 0; c2 < c; c2++) {
+      same = 1;
+      for (s = 0; s < dfa->num_states && same; s++) {
+        same = (dfa->trans[s * 256 + c] == dfa->trans[s * 256 + c2]);
+      }
+      if (same) { break; }
+    }
+    dfa->cls[c] = (c2 < c) ? dfa->cls[c2] : (unsigned char)dfa->num_cls++;
+  }
+  return 1;
+}  /* dfa_build */
+
+
+static void dfa_free(dfa_t *dfa) {
+  int s;
+
+  for (s = 0; s < dfa->num_states; s++) {
+    free(dfa->sets[s]);
+  }
+  free(dfa->sets);
+  free(dfa->set_len);
+  free(dfa->hash_next);
+  free(dfa->accept);
+  free(dfa->trans);
+}  /* dfa_free */
+
+
+/* Write s as a C string literal. */
+static void put_str(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s != '\0'; s++) {
+    if (*s == '"' || *s == '\\') {
+      fprintf(out, "\\%c", *s);
+    } else if ((unsigned char)*s < 0x20 || (unsigned char)*s >= 0x7f) {
+      fprintf(out, "\\%03o", (unsigned char)*s);
+    } else {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+}  /* put_str */
+
+
+/* Write pattern k's tables and matcher function.  accept bit 1: matched;
+ * bit 2: matched if the text ends here (also set with bit 1). */
+static void gen_pattern(FILE *out, int k, dfa_t *dfa) {
+  int s, c, col;
+
+  fprintf(out, "/* Pattern %d: %d states, %d byte classes. */\n", k, dfa->num_states, dfa->num_cls);
+  fprintf(out, "static const unsigned char re_gen_%d_cls[256] = {", k);
+  for (c = 0; c < 256; c++) {
+    fprintf(out, "%s%d", (c % 32 == 0) ? "\n  " : "", dfa->cls[c]);
+    if (c < 255) { fputc(',', out); }
+  }
+  fprintf(out, "\n};\n");
+
+  fprintf(out, "static const unsigned short re_gen_%d_next[%d] = {", k, dfa->num_states * dfa->num_cls);
+  for (s = 0; s < dfa->num_states; s++) {
+    fprintf(out, "\n ");
+    for (col = 0; col < dfa->num_cls; col++) {
+      for (c = 0; dfa->cls[c] != col; c++) { }
+      fprintf(out, " %d%s", dfa->trans[s * 256 + c],
+          (s == dfa->num_states - 1 && col == dfa->num_cls - 1) ? "" : ",");
+    }
+  }
+  fprintf(out, "\n};\n");
+
+  fprintf(out, "static const unsigned char re_gen_%d_accept[%d] = {", k, dfa->num_states);
+  for (s = 0; s < dfa->num_states; s++) {
+    fprintf(out, "%s%d", (s % 32 == 0) ? "\n  " : "", (dfa->accept[s] == 1) ? 3 : dfa->accept[s]);
+    if (s < dfa->num_states - 1) { fputc(',', out); }
+  }
+  fprintf(out, "\n};\n");
+
+  /* As re_matchn, a newline at the very end may come before '$'. */
+  fprintf(out,
+      "static int re_gen_%d(const char *text, int text_len) {\n"
+      "  const unsigned char *p = (const unsigned char *)text;\n"
+      "  const unsigned char *end = p + text_len;\n"
+      "  unsigned s = 0;\n"
+      "  int nl = (text_len > 0 && text[text_len - 1] == '\\n');\n"
+      "\n"
+      "  if (re_gen_%d_accept[0] & 1) { return 1; }\n"
+      "  if (nl) { end--; }\n"
+      "  while (p < end) {\n"
+      "    s = re_gen_%d_next[s * %d + re_gen_%d_cls[*p++]];\n"
+      "    if (re_gen_%d_accept[s] & 1) { return 1; }\n",
+      k, k, k, dfa->num_cls, k, k);
+  if (dfa->dead >= 0) {
+    fprintf(out, "    if (s == %d) { return 0; }\n", dfa->dead);
+  }
+  fprintf(out,
+      "  }\n"
+      "  if (re_gen_%d_accept[s] & 2) { return 1; }\n"
+      "  if (nl) {\n"
+      "    s = re_gen_%d_next[s * %d + re_gen_%d_cls['\\n']];\n"
+      "    return (re_gen_%d_accept[s] & 2) != 0;\n"
+      "  }\n"
+      "  return 0;\n"
+      "}  /* re_gen_%d */\n\n\n",
+      k, k, dfa->num_cls, k, k, k);
+}  /* gen_pattern */
+
+
+int main(int argc, char **argv) {
+  FILE *in, *out = stdout;
+  char line[512];
+  char **pats = NULL;
+  int num_pats = 0, len, k, arg = 1;
+  dfa_t dfa;
+  re_t *re;
+
+  if (argc >= 3 && strcmp(argv[1], "-o") == 0) {
+    out = fopen(argv[2], "w");
+    if (out == NULL) { perror(argv[2]); exit(1); }
+    arg = 3;
+  }
+  if (argc != arg + 1) {
+    fprintf(stderr, "Usage: re_gen [-o out.c] <pattern_file>\n"
+        "  pattern_file has one pattern per line, written as for mon_pattern\n"
+        "  (blank lines and lines starting with '#' are skipped).\n");
+    exit(1);
+  }
+  in = fopen(argv[arg], "r");
+  if (in == NULL) { perror(argv[arg]); exit(1); }
+
+  fprintf(out, "/* Generated by re_gen from %s; do not edit. */\n\n#include \"re.h\"\n\n\n", argv[arg]);
+  while (fgets(line, sizeof(line), in) != NULL) {
+    len = (int)strlen(line);
+    /* No newline: either the last line, or one too long for line[]. */
+    if (len > 0 && line[len - 1] != '\n' && fgetc(in) != EOF) {
+      fprintf(stderr, "ERROR: re_gen: pattern line longer than %d bytes in '%s'\n",
+          (int)sizeof(line) - 2, argv[arg]);
+      exit(1);
+    }
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if (len == 0 || line[0] == '#') { continue; }
+
+    re = re_compile(line);
+    if (re == NULL) {
+      fprintf(stderr, "ERROR: re_gen: bad pattern '%s'\n", line);
+      exit(1);
+    }
+    if (!dfa_build(&dfa, re)) {
+      fprintf(stderr, "ERROR: re_gen: pattern '%s' needs more than %d DFA states\n", line, MAX_STATES);
+      exit(1);
+    }
+    gen_pattern(out, num_pats, &dfa);
+    dfa_free(&dfa);
+    re_free(re);
+
+    pats = (char **)realloc(pats, (num_pats + 1) * sizeof(char *));  E(pats == NULL);
+    pats[num_pats] = strdup(line);  E(pats[num_pats] == NULL);
+    num_pats++;
+  }
+  fclose(in);
+
+  fprintf(out, "const re_gen_entry_t re_gen_patterns[] = {\n");
+  for (k = 0; k < num_pats; k++) {
+    fprintf(out, "  {");
+    put_str(out, pats[k]);
+    fprintf(out, ", re_gen_%d},\n", k);
+    free(pats[k]);
+  }
+  fprintf(out, "  {NULL, NULL}\n};\n");
+  free(pats);
+
+  if (out != stdout) { fclose(out); }
+  return 0;
+}  /* main */
@@ -0,0 +1,122 @@
+/* re_gen_bench.c - Compare re_gen matchers with the re interpreter (for
+ *   re_gen_bench.sh).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include "re.h"
+#include "corpus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+/* Linked from re_gen's output. */
+extern const re_gen_entry_t re_gen_patterns[];
+
+corpus_t *corpus;
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}  /* now_ns */
+
+
+/* Match every line with re (or fn, if re is NULL), reps times.  Returns
+ * ns per line; sets *matches (per pass) and, per line, res[i] (whether
+ * it matched). */
+static double run(re_t *re, re_gen_fn_t fn, int reps, int *matches, char *res) {
+  uint64_t start_ns;
+  int r, i, m = 0;
+
+  start_ns = now_ns();
+  for (r = 0; r < reps; r++) {
+    m = 0;
+    for (i = 0; i < corpus->num_lines; i++) {
+      if (re != NULL) {
+        res[i] = (char)re_matchn(re, corpus->text + corpus->line_off[i], corpus->line_len[i], NULL, NULL);
+      } else {
+        res[i] = (char)fn(corpus->text + corpus->line_off[i], corpus->line_len[i]);
+      }
+      m += res[i];
+    }
+  }
+  *matches = m;
+  return (double)(now_ns() - start_ns) / ((double)corpus->num_lines * reps);
+}  /* run */
+
+
+int main(int argc, char **argv) {
+  re_t *bt, *vm, *gen;
+  double bt_ns, vm_ns, gen_ns, dfa_ns;
+  int bt_m, vm_m, gen_m, dfa_m;
+  char *bt_res, *vm_res, *gen_res, *dfa_res;
+  int reps, k, i, rc = 0;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: re_gen_bench <corpus_file> [repetitions]\n");
+    exit(1);
+  }
+  corpus = corpus_load(argv[1]);
+  reps = (argc == 3) ? atoi(argv[2]) : 1;
+  E(reps < 1 || corpus->num_lines == 0);
+  bt_res = (char *)malloc(corpus->num_lines);  E(bt_res == NULL);
+  vm_res = (char *)malloc(corpus->num_lines);  E(vm_res == NULL);
+  gen_res = (char *)malloc(corpus->num_lines);  E(gen_res == NULL);
+  dfa_res = (char *)malloc(corpus->num_lines);  E(dfa_res == NULL);
+
+  for (k = 0; re_gen_patterns[k].pattern != NULL; k++) {
+    re_set_gen_table(NULL);
+    bt = re_compile(re_gen_patterns[k].pattern);  E(bt == NULL);
+    re_set_engine(bt, RE_ENGINE_BACKTRACK);
+    vm = re_compile(re_gen_patterns[k].pattern);  E(vm == NULL);
+    re_set_engine(vm, RE_ENGINE_PIKEVM);
+    re_set_gen_table(re_gen_patterns);
+    gen = re_compile(re_gen_patterns[k].pattern);  E(gen == NULL || gen->gen == NULL);
+
+    bt_ns = run(bt, NULL, reps, &bt_m, bt_res);
+    vm_ns = run(vm, NULL, reps, &vm_m, vm_res);
+    gen_ns = run(gen, NULL, reps, &gen_m, gen_res);  /* As dual_cap uses it: after the literal check. */
+    dfa_ns = run(NULL, re_gen_patterns[k].fn, reps, &dfa_m, dfa_res);  /* The generated function alone. */
+
+    printf("pattern=%-24s lines=%d matches=%d backtrack_ns_per_line=%.1f pikevm_ns_per_line=%.1f gen_ns_per_line=%.1f gen_dfa_ns_per_line=%.1f\n",
+        re_gen_patterns[k].pattern, corpus->num_lines, gen_m, bt_ns, vm_ns, gen_ns, dfa_ns);
+    for (i = 0; i < corpus->num_lines; i++) {
+      if (bt_res[i] != gen_res[i] || vm_res[i] != gen_res[i] || dfa_res[i] != gen_res[i]) {
+        printf("MISMATCH: pattern '%s' line %d: backtrack=%d pikevm=%d gen=%d gen_dfa=%d: %.*s\n",
+            re_gen_patterns[k].pattern, i + 1, bt_res[i], vm_res[i], gen_res[i], dfa_res[i],
+            corpus->line_len[i], corpus->text + corpus->line_off[i]);
+        rc = 1;
+        break;  /* The first one is enough. */
+      }
+    }
+    re_free(bt);
+    re_free(vm);
+    re_free(gen);
+  }
+
+  free(bt_res);
+  free(vm_res);
+  free(gen_res);
+  free(dfa_res);
+  corpus_free(corpus);
+  return rc;
+}  /* main */
@@ -0,0 +1,39 @@
+#!/bin/bash
+# re_gen_bench.sh - Compare re_gen's generated matchers with the re
+#   interpreter (both engines) on the same log corpus.  Exits non-zero
+#   if they disagree on any line.
+# Usage: ./re_gen_bench.sh [corpus_file|lines [pattern_file [repetitions]]]
+#   Given a number of lines (default 200000) instead of a corpus, a
+#   synthetic one is written with log_gen.
+
+CORPUS=${1:-200000}
+PATS=${2:-}
+REPS=${3:-3}
+
+# Not bld.sh: that would rebuild dual_cap (e.g. under tst.sh).
+gcc -Wall -g -o re_gen re_gen.c re.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+
+if echo "$CORPUS" | egrep '^[0-9]+$' >/dev/null; then :
+  gcc -Wall -O2 -o log_gen log_gen.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+  ./log_gen -n $CORPUS -d 0.02 -o bench_corpus.log;  if [ "$?" -ne 0 ]; then exit 1; fi
+  CORPUS=bench_corpus.log
+fi
+if [ -z "$PATS" ]; then :
+  PATS=bench_pats.txt
+  cat >$PATS <<__PATS__
+status=503
+^2024.*ERROR.*status=503
+took [5-9][0-9][0-9] ms
+worker-1[0-5]\].*status=5\d\d
+status=503 [a-z ]+$
+[^a-z]ERROR\s
+__PATS__
+fi
+
+./re_gen -o re_gen_bench_pats.c $PATS;  if [ "$?" -ne 0 ]; then exit 1; fi
+gcc -Wall -O2 -o re_gen_bench re_gen_bench.c re_gen_bench_pats.c corpus.c re.c;  if [ "$?" -ne 0 ]; then exit 1; fi
+./re_gen_bench $CORPUS $REPS
+RC=$?
+
+rm -f log_gen re_gen_bench re_gen_bench_pats.c bench_pats.txt bench_corpus.log
+exit $RC
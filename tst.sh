@@ -76,6 +76,9 @@ FAIL=0
 
 # First test - verify listener can trigger.
 
+rm -f stats1.json
+echo "stats_file=stats1.json" >>listener.cfg
+
 start_caps
 
 # Triggering listener.
@@ -88,6 +91,13 @@ sleep 0.5
 
 check_exits
 
+if grep -q '"trigger": "local"' stats1.json 2>/dev/null; then :
+else :
+  echo "ERROR: stats_file not written."
+  ((FAIL++))
+fi
+rm -f stats1.json
+
 # Second test - verify initiator can trigger.
 
 start_caps
@@ -166,6 +176,7 @@ else
 fi
 
 # Fourth test - mon_pattern: non-matching lines should not trigger.
+# (The initiator also uses the portable threaded backend here.)
 
 cat >listener.cfg <<__EOF__
 listen_port=9877
@@ -178,6 +189,7 @@ init_ip=127.0.0.1
 init_port=9877
 mon_file=logfile2.log
 mon_pattern=ERROR
+event_loop=0
 __EOF__
 
 start_caps
@@ -226,6 +238,617 @@ sleep 0.5
 
 check_exits
 
+# Sixth test - multiple mon_pattern keys: any of them triggers.
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=ERROR
+mon_pattern=^FATAL.*disk
+__EOF__
+
+start_caps
+
+echo "FATAL: out of memory" >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener triggered on non-matching line (test 6)."
+  ((FAIL++))
+fi
+
+echo "FATAL: disk full" >> logfile1.log
+
+sleep 0.5
+
+check_exits
+
+# Seventh test - several mon_file keys (with a glob), per-file patterns.
+
+rm -f multi_a.log multi_b.log
+echo "old line" > multi_a.log
+echo "old line" > multi_b.log
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=ERROR
+mon_file=multi_*.log
+mon_pattern=WARN
+__EOF__
+
+start_caps
+
+echo "ERROR in a multi file" >> multi_a.log
+echo "WARN in logfile1" >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener triggered on non-matching line (test 7)."
+  ((FAIL++))
+fi
+
+echo "WARN: disk filling" >> multi_b.log
+
+sleep 0.5
+
+check_exits
+
+# Eighth test - hub with two initiators: a trigger on one leaf stops all.
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+listen_peers=2
+mon_file=logfile1.log
+__EOF__
+
+cat >initiator.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile2.log
+__EOF__
+
+cat >initiator2.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile3.log
+__EOF__
+
+echo "old line" > logfile3.log
+
+start_caps  # Listener waits for the second initiator before monitoring.
+
+./dual_cap initiator2.cfg &
+INITIATOR2_PID=$!
+sleep 0.5
+
+echo "test" >> logfile3.log
+
+sleep 0.5
+
+check_exits
+
+if kill -0 $INITIATOR2_PID 2>/dev/null; then
+  echo "ERROR: Initiator2 still running."
+  kill $INITIATOR2_PID 2>/dev/null
+  ((FAIL++))
+else
+  wait $INITIATOR2_PID
+  RC=$?
+  if [ $RC -ne 0 ]; then
+    echo "FAIL: Initiator2 exited with status $RC"
+    ((FAIL++))
+  fi
+fi
+
+# Ninth test - multicast mode on loopback: no connections, one send.
+
+cat >listener.cfg <<__EOF__
+mcast_group=239.9.9.9
+mcast_port=9878
+mcast_if=127.0.0.1
+mon_file=logfile1.log
+__EOF__
+
+cat >initiator.cfg <<__EOF__
+mcast_group=239.9.9.9
+mcast_port=9878
+mcast_if=127.0.0.1
+mon_file=logfile2.log
+event_loop=0
+__EOF__
+
+start_caps
+
+echo "test" >> logfile2.log
+
+sleep 0.5
+
+check_exits
+
+# Tenth test - in-process capture (needs Linux and CAP_NET_RAW).
+
+if [ "`uname`" = "Linux" ] && [ "`id -u`" -eq 0 ]; then
+  rm -f cap1.pcapng
+
+  cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+cap_iface=lo
+cap_file=cap1.pcapng
+cap_linger_ms=200
+__EOF__
+
+  cat >initiator.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile2.log
+__EOF__
+
+  start_caps
+
+  echo "test" >> logfile1.log
+
+  sleep 0.5
+
+  check_exits
+
+  # The header blocks alone are under 100 bytes; pings add packets.
+  CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+  if [ "$CAP_SIZE" -le 100 ]; then
+    echo "FAIL: no packets in cap1.pcapng."
+    ((FAIL++))
+  fi
+
+  # Eleventh test - flight recorder: nothing written until the trigger.
+
+  rm -f cap1.pcapng
+  cat >>listener.cfg <<__EOF__
+cap_pre_mb=4
+cap_pre_ms=2000
+__EOF__
+
+  start_caps
+
+  CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+  if [ "$CAP_SIZE" -gt 100 ]; then
+    echo "FAIL: flight recorder wrote packets before the trigger."
+    ((FAIL++))
+  fi
+
+  echo "test" >> logfile1.log
+
+  sleep 0.5
+
+  check_exits
+
+  CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+  if [ "$CAP_SIZE" -le 100 ]; then
+    echo "FAIL: flight recorder wrote no packets."
+    ((FAIL++))
+  fi
+
+  # Eleventh test, continued - flight recorder with two capture threads,
+  # whose shards are merged at the end.
+
+  rm -f cap1.pcapng
+  echo "cap_threads=2" >>listener.cfg
+
+  start_caps
+
+  # Until the trigger, each thread's shard holds at most its header.
+  CAP_SIZE=`cat cap1.pcapng.shard* 2>/dev/null | wc -c`
+  if [ "$CAP_SIZE" -gt 200 ]; then
+    echo "FAIL: flight recorder (cap_threads=2) wrote packets before the trigger."
+    ((FAIL++))
+  fi
+
+  echo "test" >> logfile1.log
+
+  sleep 0.5
+
+  check_exits
+
+  CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+  if [ "$CAP_SIZE" -le 100 ]; then
+    echo "FAIL: flight recorder (cap_threads=2) wrote no packets."
+    ((FAIL++))
+  fi
+  if ls cap1.pcapng.shard* >/dev/null 2>&1; then
+    echo "FAIL: capture shards not merged."
+    ((FAIL++))
+  fi
+
+  # Twelfth test - cap_filter: the peers' TCP traffic is filtered out in
+  # the kernel (or kept, when the filter matches it), and a bad filter is
+  # refused at startup.
+
+  rm -f cap1.pcapng
+  cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+cap_iface=lo
+cap_file=cap1.pcapng
+cap_filter=icmp
+__EOF__
+
+  start_caps
+
+  echo "test" >> logfile1.log
+
+  sleep 0.5
+
+  check_exits
+
+  CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+  if [ "$CAP_SIZE" -eq 0 ] || [ "$CAP_SIZE" -gt 100 ]; then
+    echo "FAIL: cap_filter did not filter."
+    ((FAIL++))
+  fi
+
+  # The peers' own port must be captured; another port must not.
+  for PORT in 9877 9876; do :
+    rm -f cap1.pcapng
+    sed -i "s/^cap_filter=.*/cap_filter=tcp port $PORT/" listener.cfg
+
+    start_caps
+
+    echo "test" >> logfile1.log
+
+    sleep 0.5
+
+    check_exits
+
+    CAP_SIZE=`wc -c <cap1.pcapng 2>/dev/null || echo 0`
+    if [ "$PORT" -eq 9877 ] && [ "$CAP_SIZE" -le 100 ]; then
+      echo "FAIL: cap_filter=tcp port $PORT captured nothing."
+      ((FAIL++))
+    elif [ "$PORT" -ne 9877 ] && { [ "$CAP_SIZE" -eq 0 ] || [ "$CAP_SIZE" -gt 100 ]; }; then
+      echo "FAIL: cap_filter=tcp port $PORT did not filter."
+      ((FAIL++))
+    fi
+  done
+
+  echo "cap_filter=tcp port 99999" >>listener.cfg
+  if ./dual_cap listener.cfg 2>/dev/null; then
+    echo "FAIL: bad cap_filter accepted."
+    ((FAIL++))
+  fi
+
+  # Thirteenth test - gzip-compressed capture file, written with O_DIRECT
+  # (if built with zlib; see bld.sh).
+
+  if echo "#include <zlib.h>" | gcc -E - >/dev/null 2>&1; then
+    rm -f cap1.pcapng
+    cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+cap_iface=lo
+cap_file=cap1.pcapng
+cap_compress=1
+cap_direct=1
+__EOF__
+
+    start_caps
+
+    echo "test" >> logfile1.log
+
+    sleep 0.5
+
+    check_exits
+
+    if [ "`od -An -tx1 -N2 cap1.pcapng 2>/dev/null`" != " 1f 8b" ]; then
+      echo "FAIL: cap_compress file is not gzip."
+      ((FAIL++))
+    elif [ "`gzip -dc <cap1.pcapng | wc -c`" -le 100 ]; then
+      echo "FAIL: no packets in compressed cap1.pcapng."
+      ((FAIL++))
+    fi
+  else
+    echo "FYI: zlib not found; skipping cap_compress test."
+  fi
+else
+  echo "FYI: not root on Linux; skipping cap_iface tests."
+fi
+
+# Fourteenth test - rearm: the first trigger rotates to the next numbered
+# files and both keep running; the second ends the run (rearm_max).
+
+rm -f stats1.json stats2.json cap1.pcapng cap2.pcapng
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+rearm=1
+rearm_max=2
+stats_file=stats%n.json
+__EOF__
+
+cat >initiator.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile2.log
+rearm=1
+rearm_max=2
+event_loop=0
+__EOF__
+
+if [ "`uname`" = "Linux" ] && [ "`id -u`" -eq 0 ]; then
+  cat >>listener.cfg <<__EOF__
+cap_iface=lo
+cap_file=cap%n.pcapng
+cap_linger_ms=200
+__EOF__
+fi
+
+start_caps
+
+echo "test" >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null && kill -0 $INITIATOR_PID 2>/dev/null; then :
+else
+  echo "FAIL: rearm did not keep running after the first trigger."
+  ((FAIL++))
+fi
+
+echo "test" >> logfile2.log
+sleep 1
+
+check_exits
+
+for N in 1 2; do :
+  if grep -q "\"trigger_num\": $N" stats$N.json 2>/dev/null; then :
+  else :
+    echo "FAIL: no report for trigger $N."
+    ((FAIL++))
+  fi
+done
+if [ "`uname`" = "Linux" ] && [ "`id -u`" -eq 0 ]; then
+  if [ ! -s cap1.pcapng ] || [ ! -s cap2.pcapng ]; then
+    echo "FAIL: rearm did not write cap1.pcapng and cap2.pcapng."
+    ((FAIL++))
+  fi
+fi
+rm -f stats1.json stats2.json
+
+# Fifteenth test - peer link: the initiator starts first and waits for
+# the listener, and a lost connection is not a trigger (the initiator
+# reconnects to a restarted listener).
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+peer_timeout_ms=1000
+__EOF__
+
+cat >initiator.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile2.log
+peer_timeout_ms=1000
+__EOF__
+
+./dual_cap initiator.cfg &
+INITIATOR_PID=$!
+sleep 0.5
+
+./dual_cap listener.cfg &
+LISTENER_PID=$!
+sleep 1
+
+kill -9 $LISTENER_PID 2>/dev/null
+wait $LISTENER_PID 2>/dev/null
+sleep 0.5
+
+if kill -0 $INITIATOR_PID 2>/dev/null; then :
+else
+  echo "FAIL: initiator exited when its connection was lost."
+  ((FAIL++))
+fi
+
+./dual_cap listener.cfg &
+LISTENER_PID=$!
+sleep 1
+
+echo "test" >> logfile1.log
+
+sleep 0.5
+
+check_exits
+
+# Sixteenth test - mon_rate: a RETRANS line only counts; 5 of them within
+# 2 seconds trigger.
+
+rm -f stats1.json
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=RETRANS
+mon_rate=5/2000
+mon_pattern=ERROR
+stats_file=stats1.json
+__EOF__
+
+rm -f stats2.json
+cat >initiator.cfg <<__EOF__
+init_ip=127.0.0.1
+init_port=9877
+mon_file=logfile2.log
+stats_file=stats2.json
+__EOF__
+
+start_caps
+
+for I in 1 2 3; do echo "RETRANS seq $I" >> logfile1.log; done
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener triggered below mon_rate (test 16)."
+  ((FAIL++))
+fi
+
+for I in 4 5; do echo "RETRANS seq $I" >> logfile1.log; done
+
+sleep 0.5
+
+check_exits
+
+if grep -q '"window_ms": 2000' stats1.json 2>/dev/null; then :
+else :
+  echo "FAIL: mon_rate not in stats_file."
+  ((FAIL++))
+fi
+# The peer learns which rule fired, and at what rate.
+if grep -q '"trigger_reason": "mon_pattern 1 5/2000 5 ' stats2.json 2>/dev/null; then :
+else :
+  echo "FAIL: mon_rate trigger reason not sent to the peer (test 16)."
+  ((FAIL++))
+fi
+rm -f stats1.json stats2.json
+
+# Seventeenth test - mon_field on JSON lines: only the top-level "level"
+# field counts, not the same text elsewhere in the line.
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_field=level:ERROR
+mon_field=latency_ms>500
+__EOF__
+
+start_caps
+
+echo '{"level":"INFO","msg":"level:ERROR","ctx":{"level":"ERROR"},"latency_ms":20}' >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener triggered on non-matching field (test 17)."
+  ((FAIL++))
+fi
+
+echo '{"level":"INFO","latency_ms":731.5}' >> logfile1.log
+
+sleep 0.5
+
+check_exits
+
+# Eighteenth test - lines longer than the 1 MB read buffer are streamed:
+# "^" is the start of the whole line, not of the buffer, and a match may
+# span buffers.
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=^START.*END$
+__EOF__
+
+start_caps
+
+(head -c 1048576 /dev/zero | tr '\0' a; echo "START mid-line END") >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener matched ^ in the middle of a long line (test 18)."
+  ((FAIL++))
+fi
+
+(echo -n "START"; head -c 3000000 /dev/zero | tr '\0' b; echo "END") >> logfile1.log
+
+sleep 0.5
+
+check_exits
+
+# Nineteenth test - mon_workers: a burst of lines is matched in parallel,
+# and the earliest matching line wins even if a later one matches a
+# pattern listed first.
+
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=ZZZ_LATE
+mon_pattern=AAA_EARLY
+mon_workers=3
+stats_file=stats1.json
+__EOF__
+
+start_caps
+
+(seq -f "filler line %g" 1 20000; echo "AAA_EARLY"; seq -f "filler line %g" 1 20000
+ echo "ZZZ_LATE"; seq -f "filler line %g" 1 5) > burst.tmp
+# One write, so that the whole burst is read at once.
+dd if=burst.tmp of=logfile1.log oflag=append conv=notrunc bs=4M status=none
+rm -f burst.tmp
+
+sleep 0.5
+
+check_exits
+
+if grep -q '"trigger_pattern": "AAA_EARLY"' stats1.json 2>/dev/null && grep -q '"lines": 20001,' stats1.json; then :
+else :
+  echo "FAIL: mon_workers did not report the earliest match (test 19)."
+  ((FAIL++))
+fi
+if grep -q '"batches": [1-9]' stats1.json 2>/dev/null; then :
+else :
+  echo "FAIL: mon_workers matched nothing (test 19)."
+  ((FAIL++))
+fi
+rm -f stats1.json
+
+# Twentieth test - re_gen's generated matchers agree with both engines.
+
+if ./re_gen_bench.sh 20000 "" 1 >/dev/null; then :
+else :
+  echo "FAIL: re_gen matchers disagree with the interpreter (test 20)."
+  ((FAIL++))
+fi
+
+# Twenty-first test - a character class longer than 256 bytes (once the
+# limit of the class buffer).
+
+CLASS=$(printf 'x%.0s' $(seq 1 300))
+cat >listener.cfg <<__EOF__
+listen_port=9877
+mon_file=logfile1.log
+mon_pattern=CLS[${CLASS}Z]END
+__EOF__
+
+start_caps
+
+echo "CLSyEND" >> logfile1.log
+sleep 1
+
+if kill -0 $LISTENER_PID 2>/dev/null; then :
+else
+  echo "FAIL: listener matched outside a long class (test 21)."
+  ((FAIL++))
+fi
+
+echo "CLSZEND" >> logfile1.log
+
+sleep 0.5
+
+check_exits
+
+# Twenty-second test - the benchmarks run, and both engines agree on
+# plain and JSON corpora.
+
+for J in "" -j; do :
+  BENCH_OUT=`./bench.sh -r 1 -n 20000 -d 0.05 $J`
+  if [ "$?" -eq 0 ] && echo "$BENCH_OUT" | grep -q '^bench=mon_scan class=all'; then :
+  else :
+    echo "FAIL: bench.sh $J failed (test 22)."
+    ((FAIL++))
+  fi
+done
+
 if [ "$FAIL" -gt 0 ]; then :
   echo "ERROR, $FAIL tests failed"
   exit 1
@@ -0,0 +1,82 @@
+/* udp_gen.c - Send UDP datagrams at a fixed rate (for cap_bench.sh).
+ * See https://github.com/fordsfords/dual_cap for documentation. */
+
+/* This work is dedicated to the public domain under CC0 1.0 Universal:
+ * http://creativecommons.org/publicdomain/zero/1.0/
+ *
+ * To the extent possible under law, Steven Ford has waived all copyright
+ * and related or neighboring rights to this work. In other words, you can
+ * use this code for any purpose without any restrictions.
+ * This work is published from: United States.
+ * Project home: https://github.com/fordsfords/dual_cap
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define E(e_expr_) do { \
+  if (e_expr_) { \
+    fprintf(stderr, "ERROR [%s:%d]: '%s'\n", __FILE__, __LINE__, #e_expr_); \
+    exit(1); \
+  } \
+} while (0)
+
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}  /* now_ns */
+
+
+int main(int argc, char **argv) {
+  struct sockaddr_in addr;
+  char buf[1472];
+  uint64_t start_ns, end_ns, now, sent = 0, due;
+  uint64_t rate;
+  int sock, sink, size, rc;
+  struct timespec tick = {0, 1000000};
+
+  if (argc != 6) {
+    fprintf(stderr, "Usage: udp_gen <ip> <port> <packets_per_sec> <seconds> <payload_bytes>\n");
+    exit(1);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  E(inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1);
+  addr.sin_port = htons((uint16_t)atoi(argv[2]));
+  rate = strtoull(argv[3], NULL, 10);
+  size = atoi(argv[5]);
+  E(rate == 0 || size < 0 || size > (int)sizeof(buf));
+  memset(buf, 'x', sizeof(buf));
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);  E(sock < 0);
+  /* If the destination is local, bind a socket there (never read) so the
+   * datagrams don't draw ICMP port unreachables. */
+  sink = socket(AF_INET, SOCK_DGRAM, 0);  E(sink < 0);
+  (void)bind(sink, (struct sockaddr *)&addr, sizeof(addr));
+
+  /* Each millisecond, send however many packets are due by then. */
+  start_ns = now_ns();
+  end_ns = start_ns + (uint64_t)(atof(argv[4]) * 1e9);
+  while ((now = now_ns()) < end_ns) {
+    due = (now - start_ns) * rate / 1000000000ULL;
+    while (sent < due) {
+      rc = (int)sendto(sock, buf, (size_t)size, 0, (struct sockaddr *)&addr, sizeof(addr));
+      E(rc != size);
+      sent++;
+    }
+    nanosleep(&tick, NULL);
+  }
+
+  printf("sent=%llu\n", (unsigned long long)sent);
+  close(sock);
+  close(sink);
+  return 0;
+}  /* main */